@@ -6,85 +6,4234 @@
 #include <vulkan/vk_enum_string_helper.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <optional>
 #include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
+// Scene updates use SSE2 where we have it, which is everywhere on x86-64.
+#if defined(__SSE2__) || defined(_M_X64)
+#define SCENE_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #define APP_NAME "vulkan-tutorial"
 
-#define DEFAULT_WIDTH (800)
-#define DEFAULT_HEIGHT (600)
+#define DEFAULT_WIDTH (800)
+#define DEFAULT_HEIGHT (600)
+
+// Log levels, most severe first. A line is written if its level is at or
+// above the logger's.
+enum class LogLevel : int {
+    error,
+    warning,
+    info,
+    debug,
+};
+
+static const char *log_level_name(LogLevel level) {
+    switch (level) {
+    case LogLevel::error: return "error";
+    case LogLevel::warning: return "warning";
+    case LogLevel::info: return "info";
+    case LogLevel::debug: return "debug";
+    }
+    return "?";
+}
+
+// Logging that keeps the terminal off the calling thread. Each thread puts
+// its lines, already formatted, into a ring of fixed-size records that only
+// it writes and only the logger's own thread reads. So logging takes no
+// locks and never waits for output. Every few milliseconds the logger's
+// thread drains the rings and writes the lines out in the order they were
+// logged: errors and warnings to stderr, the rest to stdout. A thread that
+// fills its ring loses lines, which are counted, rather than waiting for
+// room.
+//
+// Before start() and after stop(), or when `synchronous`, lines are written
+// straight out by the thread logging them instead.
+class Logger {
+public:
+    // Longer lines get cut short.
+    static constexpr std::size_t max_line = 240;
+
+    // The lines a thread has logged and how long it spent logging them,
+    // formatting included.
+    struct ThreadStats {
+        uint64_t lines = 0;
+        double seconds = 0.0;
+        double max_seconds = 0.0;
+    };
+
+    // Set before start() and not changed after.
+    bool synchronous = false;
+
+    ~Logger() {
+        stop();
+    }
+
+    bool enabled(LogLevel level) const {
+        return static_cast<int>(level) <= level_.load(std::memory_order_relaxed);
+    }
+
+    LogLevel level() const {
+        return static_cast<LogLevel>(level_.load(std::memory_order_relaxed));
+    }
+
+    // Can be changed at any time, from any thread.
+    void set_level(LogLevel level) {
+        level_.store(static_cast<int>(level), std::memory_order_relaxed);
+    }
+
+    void start() {
+        if (synchronous || thread_.joinable()) {
+            return;
+        }
+        running_.store(true, std::memory_order_release);
+        thread_ = std::thread([this] { drain_loop(); });
+    }
+
+    // Writes out everything logged so far. Anything logged after this is
+    // written straight away again.
+    void stop() {
+        if (!thread_.joinable()) {
+            return;
+        }
+        running_.store(false, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+        // For lines from threads that hadn't seen we were stopping.
+        drain();
+    }
+
+    void write(LogLevel level, const char *text, std::size_t length) {
+        if (!running_.load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> lock(output_mutex_);
+            output(level, text, length);
+            std::cout.flush();
+            return;
+        }
+        Ring &ring = local();
+        const uint64_t head = ring.head.load(std::memory_order_relaxed);
+        if (head - ring.tail.load(std::memory_order_acquire) == capacity) {
+            ring.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        Record &record = ring.records[head % capacity];
+        record.sequence = sequence_.fetch_add(1, std::memory_order_relaxed);
+        record.level = level;
+        record.length = static_cast<uint32_t>(length);
+        std::memcpy(record.text, text, length);
+        ring.head.store(head + 1, std::memory_order_release);
+    }
+
+    // Lines lost to full rings so far.
+    uint64_t dropped() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t total = 0;
+        for (const auto &ring : rings_) {
+            total += ring->dropped.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    static ThreadStats &thread_stats() {
+        thread_local ThreadStats stats;
+        return stats;
+    }
+
+private:
+    static constexpr uint64_t capacity = 1024;
+
+    struct Record {
+        uint64_t sequence;
+        LogLevel level;
+        uint32_t length;
+        char text[max_line];
+    };
+
+    // The owning thread fills records and bumps `head`, the draining thread
+    // empties them and bumps `tail`.
+    struct Ring {
+        std::unique_ptr<Record[]> records{new Record[capacity]};
+        std::atomic<uint64_t> head{0};
+        std::atomic<uint64_t> tail{0};
+        std::atomic<uint64_t> dropped{0};
+    };
+
+    static void output(LogLevel level, const char *text, std::size_t length) {
+        std::ostream &out = level <= LogLevel::warning ? std::cerr : std::cout;
+        out.write(text, static_cast<std::streamsize>(length));
+        out.put('\n');
+    }
+
+    // The calling thread's ring, made on first use. The logger keeps it, so
+    // lines logged just before a thread exits still get written.
+    Ring &local() {
+        thread_local Ring *ring = nullptr;
+        if (!ring) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            rings_.push_back(std::make_unique<Ring>());
+            ring = rings_.back().get();
+        }
+        return *ring;
+    }
+
+    void drain() {
+        std::lock_guard<std::mutex> output_lock(output_mutex_);
+        batch_.clear();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const auto &ring : rings_) {
+                const uint64_t head = ring->head.load(std::memory_order_acquire);
+                for (uint64_t i = ring->tail.load(std::memory_order_relaxed); i != head; ++i) {
+                    batch_.push_back(ring->records[i % capacity]);
+                }
+                ring->tail.store(head, std::memory_order_release);
+            }
+        }
+        if (batch_.empty()) {
+            return;
+        }
+        std::sort(batch_.begin(), batch_.end(), [](const Record &a, const Record &b) {
+            return a.sequence < b.sequence;
+        });
+        for (const Record &record : batch_) {
+            output(record.level, record.text, record.length);
+        }
+        std::cout.flush();
+    }
+
+    void drain_loop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stopping_) {
+            cv_.wait_for(lock, std::chrono::milliseconds(5), [this] { return stopping_; });
+            lock.unlock();
+            drain();
+            lock.lock();
+        }
+    }
+
+    std::atomic<int> level_{static_cast<int>(LogLevel::info)};
+    std::atomic<bool> running_{false};
+    // Orders lines across threads.
+    std::atomic<uint64_t> sequence_{0};
+    std::thread thread_;
+    // Guards the list of rings and stopping.
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stopping_ = false;
+    std::vector<std::unique_ptr<Ring>> rings_;
+    // Held while writing out, so lines written straight out don't land in
+    // the middle of a drained batch.
+    std::mutex output_mutex_;
+    std::vector<Record> batch_;
+};
+
+static Logger logger;
+
+// A line to log, written when it goes out of scope. It formats into a
+// fixed buffer as it goes, so logging doesn't allocate, and skips
+// formatting entirely for levels the logger isn't writing.
+class LogLine {
+public:
+    explicit LogLine(LogLevel level) : level_(level), enabled_(logger.enabled(level)) {
+        if (enabled_) {
+            begin_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~LogLine() {
+        if (!enabled_) {
+            return;
+        }
+        logger.write(level_, text_, length_);
+        Logger::ThreadStats &stats = Logger::thread_stats();
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin_).count();
+        ++stats.lines;
+        stats.seconds += seconds;
+        stats.max_seconds = std::max(stats.max_seconds, seconds);
+    }
+
+    LogLine(const LogLine &) = delete;
+    LogLine &operator=(const LogLine &) = delete;
+
+    LogLine &operator<<(std::string_view s) {
+        if (enabled_) {
+            const std::size_t n = std::min(s.size(), Logger::max_line - length_);
+            std::memcpy(text_ + length_, s.data(), n);
+            length_ += n;
+        }
+        return *this;
+    }
+
+    LogLine &operator<<(const char *s) {
+        return *this << std::string_view(s);
+    }
+
+    LogLine &operator<<(const std::string &s) {
+        return *this << std::string_view(s);
+    }
+
+    LogLine &operator<<(char c) {
+        return *this << std::string_view(&c, 1);
+    }
+
+    LogLine &operator<<(bool b) {
+        return *this << (b ? "1" : "0");
+    }
+
+    // Numbers come out as they would from an ostream with default
+    // formatting, so six significant figures for floating point.
+    template <typename T>
+        requires std::is_arithmetic_v<T>
+    LogLine &operator<<(T value) {
+        if (enabled_) {
+            char digits[32];
+            std::to_chars_result result;
+            if constexpr (std::is_floating_point_v<T>) {
+                result = std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::general, 6);
+            } else {
+                result = std::to_chars(digits, digits + sizeof(digits), value);
+            }
+            *this << std::string_view(digits, result.ptr - digits);
+        }
+        return *this;
+    }
+
+    template <typename T>
+        requires std::is_enum_v<T>
+    LogLine &operator<<(T value) {
+        return *this << static_cast<std::underlying_type_t<T>>(value);
+    }
+
+private:
+    LogLevel level_;
+    bool enabled_;
+    std::chrono::steady_clock::time_point begin_;
+    std::size_t length_ = 0;
+    char text_[Logger::max_line];
+};
+
+static LogLine log_error() {
+    return LogLine(LogLevel::error);
+}
+
+static LogLine log_warning() {
+    return LogLine(LogLevel::warning);
+}
+
+static LogLine log_info() {
+    return LogLine(LogLevel::info);
+}
+
+static LogLine log_debug() {
+    return LogLine(LogLevel::debug);
+}
+
+static std::vector<char> read_bytes(const char *file_path) {
+    std::ifstream file(file_path, std::ios::ate | std::ios::binary);
+    if (!file) {
+        throw std::logic_error(std::string("Could not find file ") + file_path); 
+    }
+    std::vector<char> bytes(file.tellg());
+    file.seekg(0);
+    file.read(bytes.data(), bytes.size());
+    file.close();
+    return bytes;
+}
+
+static std::optional<uint32_t> find_memory_type(const VkPhysicalDeviceMemoryProperties &mem_props, uint32_t type_filter, VkMemoryPropertyFlags properties) {
+    for (uint32_t type_idx = 0; type_idx != mem_props.memoryTypeCount; ++type_idx) {
+        if ((type_filter & (1u << type_idx)) &&
+            (mem_props.memoryTypes[type_idx].propertyFlags & properties) == properties) { 
+            return type_idx;
+        }
+    }
+    return std::nullopt;
+}
+
+// Only finite values are expected, from render targets we've written.
+static float half_to_float(uint16_t h) {
+    const int exponent = (h >> 10) & 0x1f;
+    const int mantissa = h & 0x3ff;
+    const float magnitude = exponent == 0 ? std::ldexp(static_cast<float>(mantissa), -24)
+                                          : std::ldexp(static_cast<float>(mantissa | 0x400), exponent - 25);
+    return (h & 0x8000) ? -magnitude : magnitude;
+}
+
+// Given more than one queue family, the buffer is shared between them
+// concurrently, so needs no ownership transfers.
+static bool create_buffer(VkBuffer &b, VkDeviceMemory &mem,
+    const VkDevice &device, const VkAllocationCallbacks *allocator, const VkPhysicalDeviceMemoryProperties &mem_props, uint32_t bytes, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
+    const std::vector<uint32_t> &queue_families = {}) {
+    const bool concurrent = queue_families.size() > 1;
+    VkBufferCreateInfo buffer_info{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .size = bytes,
+        .usage = usage,
+        .sharingMode = concurrent ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = concurrent ? static_cast<uint32_t>(queue_families.size()) : 0u,
+        .pQueueFamilyIndices = concurrent ? queue_families.data() : NULL,
+    };
+    VkResult result;
+    if ((result = vkCreateBuffer(device, &buffer_info, allocator, &b)) != VK_SUCCESS) {
+        log_error() << "Failed to create buffer: " << string_VkResult(result);
+        return false;
+    }
+
+    VkMemoryRequirements mem_req;
+    vkGetBufferMemoryRequirements(device, b, &mem_req);
+
+    auto type_idx = find_memory_type(mem_props, mem_req.memoryTypeBits, properties);
+    if (!type_idx) {
+        log_error() << "Failed to find a suitable memory type to allocate buffer";
+        return false;
+    }
+
+    VkMemoryAllocateInfo alloc_info{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = NULL,
+        .allocationSize = mem_req.size,
+        .memoryTypeIndex = *type_idx,
+    };
+
+    if ((result = vkAllocateMemory(device, &alloc_info, allocator, &mem)) != VK_SUCCESS) {
+        log_error() << "Failed to allocate memory for buffer: " << string_VkResult(result);
+        return false;
+    }
+
+    // For now we don't do bind offsets.
+    vkBindBufferMemory(device, b, mem, 0);
+
+    return true;
+}
+
+// Same idea as create_buffer but for a single-sample 2D image with optimal
+// tiling in device local memory, plus a view of the whole thing.
+static bool create_image(VkImage &image, VkDeviceMemory &mem, VkImageView &view,
+    const VkDevice &device, const VkAllocationCallbacks *allocator, const VkPhysicalDeviceMemoryProperties &mem_props, VkExtent2D extent, uint32_t mip_levels, VkFormat format, VkImageUsageFlags usage) {
+    VkImageCreateInfo image_info{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .pNext = NULL,
+        .flags = 0,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = format,
+        .extent = {extent.width, extent.height, 1},
+        .mipLevels = mip_levels,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = 0,
+        .pQueueFamilyIndices = NULL,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+    VkResult result;
+    if ((result = vkCreateImage(device, &image_info, allocator, &image)) != VK_SUCCESS) {
+        log_error() << "Failed to create image: " << string_VkResult(result);
+        return false;
+    }
+
+    VkMemoryRequirements mem_req;
+    vkGetImageMemoryRequirements(device, image, &mem_req);
+
+    auto type_idx = find_memory_type(mem_props, mem_req.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    if (!type_idx) {
+        log_error() << "Failed to find a suitable memory type to allocate image";
+        return false;
+    }
+
+    VkMemoryAllocateInfo alloc_info{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = NULL,
+        .allocationSize = mem_req.size,
+        .memoryTypeIndex = *type_idx,
+    };
+    if ((result = vkAllocateMemory(device, &alloc_info, allocator, &mem)) != VK_SUCCESS) {
+        log_error() << "Failed to allocate memory for image: " << string_VkResult(result);
+        return false;
+    }
+    vkBindImageMemory(device, image, mem, 0);
+
+    VkImageViewCreateInfo view_info{};
+    view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view_info.image = image;
+    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_info.format = format;
+    view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    view_info.subresourceRange.baseMipLevel = 0;
+    view_info.subresourceRange.levelCount = mip_levels;
+    view_info.subresourceRange.baseArrayLayer = 0;
+    view_info.subresourceRange.layerCount = 1;
+    if ((result = vkCreateImageView(device, &view_info, allocator, &view)) != VK_SUCCESS) {
+        log_error() << "Failed to create image view: " << string_VkResult(result);
+        return false;
+    }
+    return true;
+}
+
+struct Options {
+    // Render the scene into an offscreen target at a fraction of the swap
+    // chain resolution and blit it up, adjusting the fraction each frame to
+    // stay within frame_budget_ms of GPU time.
+    bool dynamic_resolution = false;
+    float frame_budget_ms = 16.6f;
+    float min_render_scale = 0.5f;
+
+    // Copy every presented frame back to the host and write it out to this
+    // path. The extension picks the format: .png writes numbered files,
+    // .y4m and .raw write a single stream.
+    std::string capture_path;
+    // Quit after this many frames, 0 to run until the window is closed.
+    uint64_t max_frames = 0;
+
+    // Regression checking. Compare the last frame against a reference image,
+    // allowing each channel to be off by up to `tolerance` and up to
+    // max_mismatch_percent of pixels to exceed that.
+    std::string compare_path;
+    uint64_t tolerance = 2;
+    float max_mismatch_percent = 0.0f;
+    // Compare startup and average frame time against (or write) a baseline,
+    // failing if either is more than perf_threshold_percent slower.
+    std::string perf_baseline_path;
+    std::string write_perf_baseline_path;
+    float perf_threshold_percent = 20.0f;
+
+    // KTX2 textures to stream in, a generated checkerboard if none. The
+    // first one is drawn on the quad.
+    std::vector<std::string> texture_paths;
+    // Device memory textures may use, and how much texture data may be
+    // uploaded per frame.
+    uint64_t texture_budget_mb = 256;
+    uint64_t upload_budget_mb = 8;
+
+    // Load textures and shaders from this asset bundle instead of loose
+    // files, or pack the loose files into one and exit. Chunks are read and
+    // decompressed on this many threads, 0 for one per core.
+    std::string bundle_path;
+    std::string pack_path;
+    uint64_t load_threads = 0;
+
+    // Put all textures and buffers in one big descriptor table indexed from
+    // push constants, so there's a single descriptor set bind per frame
+    // instead of one per draw. Needs Vulkan 1.2.
+    bool bindless = false;
+    // Number of quads to draw per frame, as a draw submission benchmark.
+    uint64_t draws = 1;
+    // How fast the quads spin, in degrees per second. Their transforms are
+    // worked out every frame regardless. Or just time that at a range of
+    // scene sizes and exit.
+    float spin = 0.0f;
+    bool bench_transforms = false;
+    // Step the scene at this many ticks per second on a thread of its own,
+    // interpolating between ticks to render, instead of updating it every
+    // frame.
+    float tick_rate = 0.0f;
+    // Skip drawing objects that are off screen, found with a BVH.
+    bool cull = false;
+    // How finely to tessellate the quad, in cells along each side, and
+    // whether to draw simpler versions of it when it's small on screen:
+    // the coarsest whose error is under lod_error pixels.
+    uint64_t mesh_detail = 1;
+    bool lod = false;
+    float lod_error = 1.0f;
+    // GPU particles, simulated in a compute shader and drawn as point
+    // sprites over the scene. The simulation goes on a separate compute
+    // queue if the device has one, unless told not to.
+    uint64_t particles = 0;
+    bool async_compute = true;
+
+    // Pace frames with one timeline semaphore counting frames instead of a
+    // fence per frame in flight. Needs Vulkan 1.2.
+    bool timeline_semaphores = false;
+
+    // Only render when something has changed, blocking on window events in
+    // between, rather than rendering flat out.
+    bool on_demand = false;
+
+    // Hold back input sampling and recording until just before the GPU will
+    // be ready for the frame, to cut input-to-present latency, and/or cap
+    // the frame rate (0 for no cap).
+    bool low_latency = false;
+    float fps_cap = 0.0f;
+
+    // Pass our own VkAllocationCallbacks to count the driver's host
+    // allocations, and optionally serve COMMAND scope ones from an arena of
+    // this many KiB per frame in flight (0 for no arena).
+    bool host_allocs = false;
+    uint64_t command_arena_kb = 0;
+
+    // Count what the scene pass does on the GPU with pipeline statistics
+    // queries, and/or draw everything again additively into an offscreen
+    // target to measure overdraw, i.e. fragments shaded per pixel.
+    bool pipeline_stats = false;
+    bool overdraw = false;
+
+    // Record the scene's command buffer once per frame slot and swap image
+    // and resubmit it until something it depends on changes, rather than
+    // recording it every frame.
+    bool reuse_commands = false;
+
+    // Render with VK_KHR_dynamic_rendering (core in 1.3) straight into image
+    // views, with our own layout barriers, instead of through VkRenderPass
+    // and VkFramebuffer objects.
+    bool dynamic_rendering = false;
+
+    // Record a trace of the CPU and GPU timelines and write it here as
+    // Chrome trace JSON, on exit or when F12 is pressed.
+    std::string trace_path;
+
+    // How much to log, and whether to write lines out as they're logged
+    // rather than from the logger's thread, for comparison. V cycles the
+    // level while running.
+    LogLevel log_level = LogLevel::info;
+    bool log_sync = false;
+    // Resize the window every frame for this many frames, to see what a
+    // storm of swap chain recreations costs.
+    uint64_t resize_storm = 0;
+};
+
+static bool parse_options(int argc, char **argv, Options &options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        // Fetch the value for options of the form "--name value".
+        auto value = [&]() -> const char * {
+            if (i + 1 >= argc) {
+                log_error() << "Missing value for option " << arg;
+                return nullptr;
+            }
+            return argv[++i];
+        };
+        auto uint_value = [&](uint64_t &out) {
+            const char *v = value();
+            if (!v) {
+                return false;
+            }
+            char *end = nullptr;
+            out = std::strtoull(v, &end, 10);
+            if (end == v || *end != '\0') {
+                log_error() << "Invalid number for option " << arg << ": " << v;
+                return false;
+            }
+            return true;
+        };
+        auto float_value = [&](float &out) {
+            const char *v = value();
+            if (!v) {
+                return false;
+            }
+            char *end = nullptr;
+            out = std::strtof(v, &end);
+            if (end == v || *end != '\0') {
+                log_error() << "Invalid number for option " << arg << ": " << v;
+                return false;
+            }
+            return true;
+        };
+
+        if (arg == "--dynamic-resolution") {
+            options.dynamic_resolution = true;
+        } else if (arg == "--frame-budget-ms") {
+            if (!float_value(options.frame_budget_ms)) {
+                return false;
+            }
+        } else if (arg == "--min-render-scale") {
+            if (!float_value(options.min_render_scale)) {
+                return false;
+            }
+            options.min_render_scale = std::clamp(options.min_render_scale, 0.1f, 1.0f);
+        } else if (arg == "--capture") {
+            const char *v = value();
+            if (!v) {
+                return false;
+            }
+            options.capture_path = v;
+        } else if (arg == "--frames") {
+            if (!uint_value(options.max_frames)) {
+                return false;
+            }
+        } else if (arg == "--compare") {
+            const char *v = value();
+            if (!v) {
+                return false;
+            }
+            options.compare_path = v;
+        } else if (arg == "--tolerance") {
+            if (!uint_value(options.tolerance)) {
+                return false;
+            }
+        } else if (arg == "--max-mismatch-percent") {
+            if (!float_value(options.max_mismatch_percent)) {
+                return false;
+            }
+        } else if (arg == "--perf-baseline") {
+            const char *v = value();
+            if (!v) {
+                return false;
+            }
+            options.perf_baseline_path = v;
+        } else if (arg == "--write-perf-baseline") {
+            const char *v = value();
+            if (!v) {
+                return false;
+            }
+            options.write_perf_baseline_path = v;
+        } else if (arg == "--perf-threshold-percent") {
+            if (!float_value(options.perf_threshold_percent)) {
+                return false;
+            }
+        } else if (arg == "--texture") {
+            const char *v = value();
+            if (!v) {
+                return false;
+            }
+            options.texture_paths.push_back(v);
+        } else if (arg == "--texture-budget-mb") {
+            if (!uint_value(options.texture_budget_mb)) {
+                return false;
+            }
+        } else if (arg == "--upload-budget-mb") {
+            if (!uint_value(options.upload_budget_mb)) {
+                return false;
+            }
+        } else if (arg == "--bundle") {
+            const char *v = value();
+            if (!v) {
+                return false;
+            }
+            options.bundle_path = v;
+        } else if (arg == "--pack") {
+            const char *v = value();
+            if (!v) {
+                return false;
+            }
+            options.pack_path = v;
+        } else if (arg == "--load-threads") {
+            if (!uint_value(options.load_threads)) {
+                return false;
+            }
+        } else if (arg == "--bindless") {
+            options.bindless = true;
+        } else if (arg == "--low-latency") {
+            options.low_latency = true;
+        } else if (arg == "--fps-cap") {
+            if (!float_value(options.fps_cap)) {
+                return false;
+            }
+        } else if (arg == "--reuse-commands") {
+            options.reuse_commands = true;
+        } else if (arg == "--dynamic-rendering") {
+            options.dynamic_rendering = true;
+        } else if (arg == "--pipeline-stats") {
+            options.pipeline_stats = true;
+        } else if (arg == "--overdraw") {
+            options.overdraw = true;
+        } else if (arg == "--trace") {
+            const char *v = value();
+            if (!v) {
+                return false;
+            }
+            options.trace_path = v;
+        } else if (arg == "--log-level") {
+            const char *v = value();
+            if (!v) {
+                return false;
+            }
+            const std::string level = v;
+            if (level == "error") {
+                options.log_level = LogLevel::error;
+            } else if (level == "warning") {
+                options.log_level = LogLevel::warning;
+            } else if (level == "info") {
+                options.log_level = LogLevel::info;
+            } else if (level == "debug") {
+                options.log_level = LogLevel::debug;
+            } else {
+                log_error() << "Unknown log level " << level << ", expected error, warning, info or debug";
+                return false;
+            }
+        } else if (arg == "--log-sync") {
+            options.log_sync = true;
+        } else if (arg == "--resize-storm") {
+            if (!uint_value(options.resize_storm)) {
+                return false;
+            }
+        } else if (arg == "--host-allocs") {
+            options.host_allocs = true;
+        } else if (arg == "--command-arena-kb") {
+            if (!uint_value(options.command_arena_kb)) {
+                return false;
+            }
+            options.host_allocs = true;
+        } else if (arg == "--on-demand") {
+            options.on_demand = true;
+        } else if (arg == "--timeline-semaphores") {
+            options.timeline_semaphores = true;
+        } else if (arg == "--draws") {
+            if (!uint_value(options.draws)) {
+                return false;
+            }
+            options.draws = std::max<uint64_t>(options.draws, 1);
+        } else if (arg == "--spin") {
+            if (!float_value(options.spin)) {
+                return false;
+            }
+        } else if (arg == "--bench-transforms") {
+            options.bench_transforms = true;
+        } else if (arg == "--tick-rate") {
+            if (!float_value(options.tick_rate)) {
+                return false;
+            }
+        } else if (arg == "--cull") {
+            options.cull = true;
+        } else if (arg == "--mesh-detail") {
+            if (!uint_value(options.mesh_detail)) {
+                return false;
+            }
+            // Indices are 16 bit.
+            options.mesh_detail = std::clamp<uint64_t>(options.mesh_detail, 1, 255);
+        } else if (arg == "--lod") {
+            options.lod = true;
+        } else if (arg == "--particles") {
+            if (!uint_value(options.particles)) {
+                return false;
+            }
+            // Keeps the buffers' sizes in 32 bits.
+            options.particles = std::min<uint64_t>(options.particles, 1 << 24);
+        } else if (arg == "--no-async-compute") {
+            options.async_compute = false;
+        } else if (arg == "--lod-error") {
+            if (!float_value(options.lod_error)) {
+                return false;
+            }
+        } else {
+            log_error() << "Unknown option " << arg;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Picks the internal render scale for the next frame from measured GPU frame
+// times. Cost scales roughly with pixel count, i.e. scale^2, so we step
+// proportionally to get back under budget quickly, but only creep back up in
+// small steps and only once comfortably under budget. The gap between the two
+// thresholds plus the cooldown is what stops us oscillating between two scales.
+struct ResolutionController {
+    float target_ms;
+    float min_scale;
+    float max_scale = 1.0f;
+    float scale = 1.0f;
+    // Exponential moving average of GPU frame time
+    float smoothed_ms = 0.0f;
+    // Frames left before we're allowed to change scale again. The timings we
+    // get back lag by max_frames_in_flight, so changing every frame would
+    // mean reacting to our own previous adjustment.
+    int cooldown = 0;
+
+    // Fraction of the budget we must drop below before scaling back up.
+    static constexpr float raise_threshold = 0.8f;
+    static constexpr float raise_step = 0.05f;
+    static constexpr float smoothing = 0.1f;
+    static constexpr int cooldown_frames = 8;
+
+    void update(float gpu_ms) {
+        smoothed_ms = smoothed_ms == 0.0f ? gpu_ms : smoothed_ms + smoothing * (gpu_ms - smoothed_ms);
+        if (cooldown > 0) {
+            --cooldown;
+            return;
+        }
+
+        float new_scale = scale;
+        if (smoothed_ms > target_ms) {
+            new_scale = scale * std::sqrt(target_ms / smoothed_ms);
+        } else if (smoothed_ms < target_ms * raise_threshold) {
+            new_scale = scale + raise_step;
+        }
+        // Quantise so tiny fluctuations don't produce a new scale every time.
+        new_scale = std::round(std::clamp(new_scale, min_scale, max_scale) * 100.0f) / 100.0f;
+        if (new_scale != scale) {
+            scale = new_scale;
+            cooldown = cooldown_frames;
+            // Timings measured at the old scale are no longer representative.
+            smoothed_ms = 0.0f;
+        }
+    }
+
+    VkExtent2D scaled(VkExtent2D extent) const {
+        return {
+            std::max(1u, static_cast<uint32_t>(extent.width * scale)),
+            std::max(1u, static_cast<uint32_t>(extent.height * scale)),
+        };
+    }
+};
+
+// Decides when to start each frame so its work reaches the GPU just as the
+// previous frame finishes, instead of queueing up behind it with input that's
+// already stale by the time it runs. All times are in milliseconds on the
+// steady_clock, with GPU timestamps mapped across by a learned offset.
+struct LatencyLimiter {
+    // Start this much earlier than strictly needed, so small mispredictions
+    // don't leave the GPU idle.
+    double margin_ms = 1.0;
+    // From the frame rate cap, 0 for none.
+    double min_interval_ms = 0.0;
+
+    // CPU time minus GPU time. Unknown until calibrated.
+    std::optional<double> offset_ms;
+    // Set once the offset comes from reading both clocks together, which
+    // beats anything calibrate() can estimate.
+    bool exact_offset = false;
+    // Exponential moving averages of GPU time per frame and of CPU time from
+    // sampling input to submitting.
+    double gpu_ms = 0.0;
+    double cpu_ms = 0.0;
+
+    static constexpr double smoothing = 0.1;
+
+    // A frame whose GPU work ended at `gpu_end_ms` (GPU clock) was seen to be
+    // complete at `seen_ms`. That can only be late, never early, so the
+    // smallest difference seen is the best estimate of the offset. Let it
+    // creep up slowly to follow drift between the clocks, and start over if
+    // it jumps, which means the timestamp counter wrapped.
+    void calibrate(double seen_ms, double gpu_end_ms) {
+        if (exact_offset) {
+            return;
+        }
+        const double sample = seen_ms - gpu_end_ms;
+        if (!offset_ms || std::abs(sample - *offset_ms) > 1000.0) {
+            offset_ms = sample;
+        } else {
+            offset_ms = std::min(sample, *offset_ms + 0.01 * (sample - *offset_ms));
+        }
+    }
+
+    void set_offset(double ms) {
+        offset_ms = ms;
+        exact_offset = true;
+    }
+
+    void frame_timed(double frame_gpu_ms) {
+        gpu_ms = gpu_ms == 0.0 ? frame_gpu_ms : gpu_ms + smoothing * (frame_gpu_ms - gpu_ms);
+    }
+
+    void frame_submitted(double sample_to_submit_ms) {
+        cpu_ms = cpu_ms == 0.0 ? sample_to_submit_ms : cpu_ms + smoothing * (sample_to_submit_ms - cpu_ms);
+    }
+
+    // When to sample input for the next frame. The previous frame was
+    // submitted at `previous_submit_ms` and can't start on the GPU before the
+    // one before it ended, at `before_previous_end_ms` if known (CPU clock).
+    double next_sample_ms(double previous_submit_ms, std::optional<double> before_previous_end_ms, double last_sample_ms) const {
+        const double previous_start = std::max(previous_submit_ms, before_previous_end_ms.value_or(previous_submit_ms));
+        const double previous_end = previous_start + gpu_ms;
+        return std::max(previous_end - cpu_ms - margin_ms, last_sample_ms + min_interval_ms);
+    }
+};
+
+// VkAllocationCallbacks that count what the driver allocates on the host,
+// per allocation scope, and notice when frames that should be in a steady
+// state are still hitting the heap. COMMAND scope allocations only need to
+// live as long as the Vulkan call that made them, so they can optionally
+// come out of a linear arena per frame in flight instead, which is reset in
+// one go once that frame is known to be done.
+class HostAllocator {
+public:
+    // Frames before this are warm-up, where allocating is expected.
+    static constexpr uint64_t warmup_frames = 10;
+
+    HostAllocator(std::size_t frames_in_flight, std::size_t arena_bytes) : arenas_(arena_bytes ? frames_in_flight : 0) {
+        for (auto &arena : arenas_) {
+            arena.memory.reset(new unsigned char[arena_bytes]);
+            arena.size = arena_bytes;
+        }
+        callbacks_ = {
+            .pUserData = this,
+            .pfnAllocation = [](void *user, std::size_t size, std::size_t alignment, VkSystemAllocationScope scope) {
+                return static_cast<HostAllocator *>(user)->allocate(size, alignment, scope);
+            },
+            .pfnReallocation = [](void *user, void *original, std::size_t size, std::size_t alignment, VkSystemAllocationScope scope) {
+                return static_cast<HostAllocator *>(user)->reallocate(original, size, alignment, scope);
+            },
+            .pfnFree = [](void *user, void *memory) {
+                static_cast<HostAllocator *>(user)->free(memory);
+            },
+            .pfnInternalAllocation = [](void *user, std::size_t size, VkInternalAllocationType, VkSystemAllocationScope scope) {
+                static_cast<HostAllocator *>(user)->internal(size, scope, true);
+            },
+            .pfnInternalFree = [](void *user, std::size_t size, VkInternalAllocationType, VkSystemAllocationScope scope) {
+                static_cast<HostAllocator *>(user)->internal(size, scope, false);
+            },
+        };
+    }
+
+    const VkAllocationCallbacks *callbacks() const {
+        return &callbacks_;
+    }
+
+    // Frame `frame` is about to be recorded using `slot`, and the frame
+    // that last used that slot has finished. Wraps up the stats for the
+    // previous frame and resets the slot's arena.
+    void begin_frame(uint64_t frame, std::size_t slot) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Coming round again for the same frame, e.g. after recreating the
+        // swap chain, just carries on counting it.
+        if (frame != frame_) {
+            if (frame_ >= warmup_frames) {
+                ++steady_frames_;
+                if (frame_heap_allocations_ != 0) {
+                    ++steady_frames_allocating_;
+                    steady_heap_allocations_ += frame_heap_allocations_;
+                    if (steady_frames_allocating_ <= 5) {
+                        log_warning() << "Host allocations: frame " << frame_ << " made " << frame_heap_allocations_ << " heap allocations";
+                    }
+                }
+            }
+            frame_ = frame;
+            frame_heap_allocations_ = 0;
+        }
+
+        if (slot < arenas_.size()) {
+            current_arena_ = slot;
+            Arena &arena = arenas_[slot];
+            // The driver should have freed everything by the time the call
+            // that allocated it returned, but if not we can't pull the memory
+            // out from under it.
+            if (arena.live == 0) {
+                arena.used = 0;
+            } else if (!arena_leak_reported_) {
+                log_warning() << "Host allocations: " << arena.live << " COMMAND scope allocations outlived their frame, not resetting arena";
+                arena_leak_reported_ = true;
+            }
+        }
+    }
+
+    void report() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        static const char *scope_names[scope_count] = {"command", "object", "cache", "device", "instance"};
+        for (std::size_t i = 0; i != scope_count; ++i) {
+            const ScopeStats &s = scopes_[i];
+            if (s.allocations == 0 && s.internal_allocations == 0) {
+                continue;
+            }
+            std::cout << "Host allocations: " << scope_names[i] << " scope " << s.allocations << " allocations";
+            if (s.arena_allocations != 0) {
+                std::cout << " (" << s.arena_allocations << " from arena)";
+            }
+            std::cout << ", " << s.reallocations << " reallocations, " << s.frees << " frees, " << s.bytes / 1024.0 << " KiB total, "
+                      << s.peak_live_bytes / 1024.0 << " KiB peak, " << s.live_bytes << " bytes still live";
+            if (s.internal_allocations != 0) {
+                std::cout << ", " << s.internal_allocations << " internal (" << s.internal_bytes / 1024.0 << " KiB)";
+            }
+            std::cout << "\n";
+        }
+        if (!arenas_.empty()) {
+            std::cout << "Host allocations: arena high water " << arena_high_water_ << " of " << arenas_[0].size << " bytes, "
+                      << arena_overflows_ << " overflowed to the heap\n";
+        }
+        if (steady_frames_ != 0) {
+            std::cout << "Host allocations: " << steady_frames_allocating_ << " of " << steady_frames_ << " frames after warm-up made heap allocations ("
+                      << steady_heap_allocations_ << " in total)\n";
+        }
+    }
+
+private:
+    static constexpr std::size_t scope_count = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+    static constexpr uint32_t no_arena = ~0u;
+
+    // Sits just before every allocation we hand out, so frees and
+    // reallocations know where the memory came from and how big it was.
+    struct Header {
+        void *base;
+        std::size_t size;
+        uint32_t scope;
+        uint32_t arena;
+    };
+
+    struct Arena {
+        std::unique_ptr<unsigned char[]> memory;
+        std::size_t size = 0;
+        std::size_t used = 0;
+        std::size_t live = 0;
+    };
+
+    struct ScopeStats {
+        uint64_t allocations = 0;
+        uint64_t arena_allocations = 0;
+        uint64_t reallocations = 0;
+        uint64_t frees = 0;
+        uint64_t bytes = 0;
+        uint64_t live_bytes = 0;
+        uint64_t peak_live_bytes = 0;
+        uint64_t internal_allocations = 0;
+        uint64_t internal_bytes = 0;
+    };
+
+    static uintptr_t align_up(uintptr_t p, std::size_t alignment) {
+        return (p + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+    }
+
+    void *allocate(std::size_t size, std::size_t alignment, VkSystemAllocationScope scope) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return allocate_locked(size, alignment, scope);
+    }
+
+    void *allocate_locked(std::size_t size, std::size_t alignment, VkSystemAllocationScope scope) {
+        alignment = std::max(alignment, alignof(Header));
+        ScopeStats &stats = scopes_[scope];
+        void *result = nullptr;
+        uint32_t arena_index = no_arena;
+
+        if (scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND && current_arena_ < arenas_.size()) {
+            Arena &arena = arenas_[current_arena_];
+            const uintptr_t begin = reinterpret_cast<uintptr_t>(arena.memory.get());
+            const uintptr_t p = align_up(begin + arena.used + sizeof(Header), alignment);
+            if (p + size <= begin + arena.size) {
+                arena.used = p + size - begin;
+                ++arena.live;
+                arena_high_water_ = std::max(arena_high_water_, arena.used);
+                arena_index = static_cast<uint32_t>(current_arena_);
+                result = reinterpret_cast<void *>(p);
+                ++stats.arena_allocations;
+            } else {
+                ++arena_overflows_;
+            }
+        }
+        void *base = nullptr;
+        if (!result) {
+            base = std::malloc(size + alignment + sizeof(Header));
+            if (!base) {
+                return nullptr;
+            }
+            result = reinterpret_cast<void *>(align_up(reinterpret_cast<uintptr_t>(base) + sizeof(Header), alignment));
+            ++frame_heap_allocations_;
+        }
+        new (static_cast<Header *>(result) - 1) Header{base, size, static_cast<uint32_t>(scope), arena_index};
+
+        ++stats.allocations;
+        stats.bytes += size;
+        stats.live_bytes += size;
+        stats.peak_live_bytes = std::max(stats.peak_live_bytes, stats.live_bytes);
+        return result;
+    }
+
+    void *reallocate(void *original, std::size_t size, std::size_t alignment, VkSystemAllocationScope scope) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!original) {
+            return allocate_locked(size, alignment, scope);
+        }
+        if (size == 0) {
+            free_locked(original);
+            return nullptr;
+        }
+        void *result = allocate_locked(size, alignment, scope);
+        if (result) {
+            std::memcpy(result, original, std::min(size, (static_cast<Header *>(original) - 1)->size));
+            free_locked(original);
+            ++scopes_[scope].reallocations;
+        }
+        return result;
+    }
+
+    void free(void *memory) {
+        if (!memory) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_locked(memory);
+    }
+
+    void free_locked(void *memory) {
+        const Header header = *(static_cast<Header *>(memory) - 1);
+        ScopeStats &stats = scopes_[header.scope];
+        ++stats.frees;
+        stats.live_bytes -= header.size;
+        if (header.arena != no_arena) {
+            // Arena memory comes back when the arena is reset.
+            --arenas_[header.arena].live;
+        } else {
+            std::free(header.base);
+        }
+    }
+
+    void internal(std::size_t size, VkSystemAllocationScope scope, bool allocated) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (allocated) {
+            ++scopes_[scope].internal_allocations;
+            scopes_[scope].internal_bytes += size;
+            ++frame_heap_allocations_;
+        }
+    }
+
+    VkAllocationCallbacks callbacks_;
+    mutable std::mutex mutex_;
+    ScopeStats scopes_[scope_count];
+
+    std::vector<Arena> arenas_;
+    std::size_t current_arena_ = 0;
+    std::size_t arena_high_water_ = 0;
+    uint64_t arena_overflows_ = 0;
+    bool arena_leak_reported_ = false;
+
+    uint64_t frame_ = 0;
+    uint64_t frame_heap_allocations_ = 0;
+    uint64_t steady_frames_ = 0;
+    uint64_t steady_frames_allocating_ = 0;
+    uint64_t steady_heap_allocations_ = 0;
+};
+
+// Records what each thread was doing when, plus when the GPU ran each
+// frame, and writes it out as Chrome trace JSON (chrome://tracing or
+// ui.perfetto.dev). Each thread appends to its own ring of events without
+// locking, so zones are cheap enough to leave in, and when tracing is off a
+// zone is just a check of `enabled`.
+class Tracer {
+public:
+    // Set before starting any other threads and not changed after.
+    bool enabled = false;
+
+    static double now_us() {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Name the calling thread in the trace. Buffers are only made while
+    // tracing, so threads that are named but never traced cost nothing.
+    void name_thread(const char *name) {
+        if (!enabled) {
+            return;
+        }
+        Buffer &buffer = local();
+        // write() reads names under the same lock.
+        std::lock_guard<std::mutex> lock(mutex_);
+        buffer.name = name;
+    }
+
+    // `name` must outlive the tracer, a string literal in practice. `arg`
+    // is shown alongside if not negative, e.g. a frame number.
+    void zone(const char *name, double begin_us, double end_us, int64_t arg = -1) {
+        if (!enabled) {
+            return;
+        }
+        append(local(), {name, begin_us, end_us, arg});
+    }
+
+    // Same, on the GPU's row, with times already on our clock. Only called
+    // from the main thread.
+    void gpu_zone(const char *name, double begin_us, double end_us, int64_t arg = -1) {
+        if (!enabled) {
+            return;
+        }
+        if (!gpu_) {
+            gpu_ = std::make_unique<Buffer>();
+            gpu_->name = "GPU";
+        }
+        append(*gpu_, {name, begin_us, end_us, arg});
+    }
+
+    bool write(const std::string &path) {
+        std::ofstream file(path);
+        if (!file) {
+            log_error() << "Failed to open " << path << " for writing";
+            return false;
+        }
+        file << std::fixed << std::setprecision(3) << "{\"traceEvents\":[\n";
+        bool first = true;
+        auto write_buffer = [&](const Buffer &buffer) {
+            file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer.tid
+                 << ",\"args\":{\"name\":\"" << buffer.name << "\"}}";
+            first = false;
+            // The owning thread may still be adding events as we read, so
+            // copy the ring out first, then check how far it got meanwhile
+            // and throw away whatever it could have overwritten. The event
+            // at `count` may be half written, hence the extra one.
+            const uint64_t count = buffer.count.load(std::memory_order_acquire);
+            const uint64_t begin = count > capacity ? count - capacity : 0;
+            std::vector<Event> events(count - begin);
+            for (uint64_t i = begin; i != count; ++i) {
+                events[i - begin] = buffer.events[i % capacity];
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const uint64_t count_after = buffer.count.load(std::memory_order_relaxed);
+            const uint64_t first_intact = count_after + 1 > capacity ? count_after + 1 - capacity : 0;
+            for (uint64_t i = std::max(begin, first_intact); i < count; ++i) {
+                const Event &event = events[i - begin];
+                file << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer.tid
+                     << ",\"ts\":" << event.begin_us << ",\"dur\":" << event.end_us - event.begin_us;
+                if (event.arg >= 0) {
+                    file << ",\"args\":{\"n\":" << event.arg << "}";
+                }
+                file << "}";
+            }
+        };
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const auto &buffer : buffers_) {
+                write_buffer(*buffer);
+            }
+        }
+        if (gpu_) {
+            write_buffer(*gpu_);
+        }
+        file << "\n]}\n";
+        if (!file) {
+            log_error() << "Failed to write trace to " << path;
+            return false;
+        }
+        log_info() << "Trace: written to " << path;
+        return true;
+    }
+
+private:
+    static constexpr uint64_t capacity = 1 << 16;
+
+    struct Event {
+        const char *name;
+        double begin_us;
+        double end_us;
+        int64_t arg;
+    };
+
+    // Only the owning thread writes events and bumps `count`, readers take
+    // `count` first and then read what's before it.
+    struct Buffer {
+        std::string name;
+        uint32_t tid = 0;
+        std::unique_ptr<Event[]> events{new Event[capacity]};
+        std::atomic<uint64_t> count{0};
+    };
+
+    static void append(Buffer &buffer, const Event &event) {
+        const uint64_t n = buffer.count.load(std::memory_order_relaxed);
+        buffer.events[n % capacity] = event;
+        buffer.count.store(n + 1, std::memory_order_release);
+    }
+
+    // The calling thread's buffer, made on first use. The tracer keeps it
+    // so it's still there to write out after the thread exits.
+    Buffer &local() {
+        thread_local Buffer *buffer = nullptr;
+        if (!buffer) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            buffers_.push_back(std::make_unique<Buffer>());
+            buffer = buffers_.back().get();
+            buffer->tid = static_cast<uint32_t>(buffers_.size());
+            buffer->name = "Thread " + std::to_string(buffer->tid);
+        }
+        return *buffer;
+    }
+
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Buffer>> buffers_;
+    std::unique_ptr<Buffer> gpu_;
+};
+
+static Tracer tracer;
+
+// Traces the rest of the enclosing scope as a zone.
+class TraceZone {
+public:
+    explicit TraceZone(const char *name, int64_t arg = -1) {
+        if (tracer.enabled) {
+            name_ = name;
+            arg_ = arg;
+            begin_us_ = Tracer::now_us();
+        }
+    }
+
+    ~TraceZone() {
+        if (name_) {
+            tracer.zone(name_, begin_us_, Tracer::now_us(), arg_);
+        }
+    }
+
+    TraceZone(const TraceZone &) = delete;
+    TraceZone &operator=(const TraceZone &) = delete;
+
+private:
+    const char *name_ = nullptr;
+    int64_t arg_ = -1;
+    double begin_us_ = 0.0;
+};
+
+static uint32_t crc32(const uint8_t *data, std::size_t size, uint32_t crc = 0) {
+    static const auto table = [] {
+        std::vector<uint32_t> t(256);
+        for (uint32_t n = 0; n != 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k != 8; ++k) {
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            t[n] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (std::size_t i = 0; i != size; ++i) {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void put_be32(std::vector<uint8_t> &out, uint32_t v) {
+    out.push_back(static_cast<uint8_t>(v >> 24));
+    out.push_back(static_cast<uint8_t>(v >> 16));
+    out.push_back(static_cast<uint8_t>(v >> 8));
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+// Writes 8-bit RGB PNG from tightly packed 4-byte pixels. The zlib stream
+// uses stored (uncompressed) deflate blocks - we care about getting frames
+// out quickly and losslessly, not about file size.
+static bool write_png(const std::string &path, const uint8_t *pixels, uint32_t width, uint32_t height, bool bgra) {
+    std::vector<uint8_t> raw;
+    raw.reserve(static_cast<std::size_t>(height) * (1 + width * 3));
+    for (uint32_t y = 0; y != height; ++y) {
+        raw.push_back(0); // filter type None
+        const uint8_t *row = pixels + static_cast<std::size_t>(y) * width * 4;
+        for (uint32_t x = 0; x != width; ++x) {
+            const uint8_t *px = row + x * 4;
+            raw.push_back(px[bgra ? 2 : 0]);
+            raw.push_back(px[1]);
+            raw.push_back(px[bgra ? 0 : 2]);
+        }
+    }
+
+    std::vector<uint8_t> zlib = {0x78, 0x01};
+    zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    uint32_t adler_a = 1, adler_b = 0;
+    std::size_t offset = 0;
+    do {
+        const std::size_t len = std::min<std::size_t>(65535, raw.size() - offset);
+        const bool final_block = offset + len == raw.size();
+        zlib.push_back(final_block ? 1 : 0);
+        zlib.push_back(static_cast<uint8_t>(len));
+        zlib.push_back(static_cast<uint8_t>(len >> 8));
+        zlib.push_back(static_cast<uint8_t>(~len));
+        zlib.push_back(static_cast<uint8_t>(~len >> 8));
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + len);
+        for (std::size_t i = offset; i != offset + len; ++i) {
+            adler_a = (adler_a + raw[i]) % 65521;
+            adler_b = (adler_b + adler_a) % 65521;
+        }
+        offset += len;
+    } while (offset != raw.size());
+    put_be32(zlib, (adler_b << 16) | adler_a);
+
+    std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    auto chunk = [&](const char *type, const std::vector<uint8_t> &data) {
+        put_be32(png, static_cast<uint32_t>(data.size()));
+        const std::size_t type_start = png.size();
+        png.insert(png.end(), type, type + 4);
+        png.insert(png.end(), data.begin(), data.end());
+        put_be32(png, crc32(png.data() + type_start, png.size() - type_start));
+    };
+    std::vector<uint8_t> header;
+    put_be32(header, width);
+    put_be32(header, height);
+    // 8 bits per channel, colour type 2 (RGB), default compression/filter, no interlace
+    header.insert(header.end(), {8, 2, 0, 0, 0});
+    chunk("IHDR", header);
+    chunk("IDAT", zlib);
+    chunk("IEND", {});
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char *>(png.data()), png.size());
+    return static_cast<bool>(file);
+}
+
+struct RgbImage {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<uint8_t> rgb;
+};
+
+static uint32_t get_be32(const uint8_t *p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+// Loads a reference image for comparison. Supports binary PPM, and PNGs as
+// written by write_png (stored deflate blocks, no filtering) so that a
+// capture can be checked in as a reference directly.
+static bool load_reference_image(const std::string &path, RgbImage &image) {
+    std::vector<char> bytes;
+    try {
+        bytes = read_bytes(path.c_str());
+    } catch (const std::exception &e) {
+        log_error() << e.what();
+        return false;
+    }
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(bytes.data());
+    const std::size_t size = bytes.size();
+
+    if (size >= 2 && data[0] == 'P' && data[1] == '6') {
+        std::size_t pos = 2;
+        auto next_number = [&]() -> uint32_t {
+            while (pos < size && (std::isspace(data[pos]) || data[pos] == '#')) {
+                if (data[pos] == '#') {
+                    while (pos < size && data[pos] != '\n') {
+                        ++pos;
+                    }
+                } else {
+                    ++pos;
+                }
+            }
+            uint32_t n = 0;
+            while (pos < size && std::isdigit(data[pos])) {
+                n = n * 10 + (data[pos++] - '0');
+            }
+            return n;
+        };
+        image.width = next_number();
+        image.height = next_number();
+        const uint32_t max_value = next_number();
+        ++pos; // single whitespace before the pixel data
+        const std::size_t pixel_bytes = static_cast<std::size_t>(image.width) * image.height * 3;
+        if (max_value != 255 || pos + pixel_bytes > size) {
+            log_error() << "Unsupported or truncated PPM " << path;
+            return false;
+        }
+        image.rgb.assign(data + pos, data + pos + pixel_bytes);
+        return true;
+    }
+
+    static const uint8_t png_signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    if (size < 8 || std::memcmp(data, png_signature, 8) != 0) {
+        log_error() << "Reference image " << path << " is neither PPM nor PNG";
+        return false;
+    }
+    std::vector<uint8_t> zlib;
+    uint32_t channels = 0;
+    for (std::size_t pos = 8; pos + 12 <= size;) {
+        const uint32_t len = get_be32(data + pos);
+        const uint8_t *type = data + pos + 4;
+        const uint8_t *chunk = data + pos + 8;
+        if (pos + 12 + len > size) {
+            break;
+        }
+        if (std::memcmp(type, "IHDR", 4) == 0) {
+            image.width = get_be32(chunk);
+            image.height = get_be32(chunk + 4);
+            const uint8_t depth = chunk[8], colour_type = chunk[9];
+            channels = colour_type == 2 ? 3 : colour_type == 6 ? 4 : 0;
+            if (depth != 8 || channels == 0 || chunk[12] != 0) {
+                log_error() << "Unsupported PNG format in " << path;
+                return false;
+            }
+        } else if (std::memcmp(type, "IDAT", 4) == 0) {
+            zlib.insert(zlib.end(), chunk, chunk + len);
+        }
+        pos += 12 + len;
+    }
+
+    // Undo the stored deflate blocks.
+    std::vector<uint8_t> raw;
+    std::size_t pos = 2;
+    for (bool final_block = false; !final_block;) {
+        if (pos + 5 > zlib.size() || (zlib[pos] & 0x6) != 0) {
+            log_error() << "Only uncompressed PNGs (as written by --capture) are supported: " << path;
+            return false;
+        }
+        final_block = zlib[pos] & 1;
+        const std::size_t len = zlib[pos + 1] | (zlib[pos + 2] << 8);
+        pos += 5;
+        if (pos + len > zlib.size()) {
+            log_error() << "Truncated PNG " << path;
+            return false;
+        }
+        raw.insert(raw.end(), zlib.begin() + pos, zlib.begin() + pos + len);
+        pos += len;
+    }
+
+    const std::size_t stride = 1 + static_cast<std::size_t>(image.width) * channels;
+    if (raw.size() < stride * image.height) {
+        log_error() << "Truncated PNG " << path;
+        return false;
+    }
+    image.rgb.resize(static_cast<std::size_t>(image.width) * image.height * 3);
+    for (uint32_t y = 0; y != image.height; ++y) {
+        const uint8_t *row = raw.data() + y * stride;
+        if (row[0] != 0) {
+            log_error() << "Only unfiltered PNGs (as written by --capture) are supported: " << path;
+            return false;
+        }
+        for (uint32_t x = 0; x != image.width; ++x) {
+            std::memcpy(&image.rgb[(static_cast<std::size_t>(y) * image.width + x) * 3], row + 1 + x * channels, 3);
+        }
+    }
+    return true;
+}
+
+// A host visible buffer that a rendered frame is copied into. The buffer
+// stays mapped for its lifetime. `busy` is set by the render thread when it
+// records a copy into it and cleared by the writer thread once the frame is
+// on disk, which is the only handshake between the two.
+struct CaptureSlot {
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    uint8_t *mapped = nullptr;
+    VkDeviceSize capacity = 0;
+    VkExtent2D extent{};
+    bool bgra = false;
+    uint64_t frame = 0;
+    std::atomic<bool> busy{false};
+};
+
+// Encodes captured frames on a background thread so that writing to disk
+// never stalls rendering.
+class FrameWriter {
+public:
+    // None just reads frames back without writing them anywhere, for when
+    // we only want the last frame to compare against a reference.
+    enum class Format { None, Png, Y4m, Raw };
+
+    ~FrameWriter() {
+        stop();
+    }
+
+    bool start(const std::string &path, bool keep_last_frame) {
+        path_ = path;
+        keep_last_frame_ = keep_last_frame;
+        auto ends_with = [&](const char *ext) {
+            const std::size_t n = std::strlen(ext);
+            return path.size() >= n && path.compare(path.size() - n, n, ext) == 0;
+        };
+        if (path.empty()) {
+            format_ = Format::None;
+        } else if (ends_with(".y4m")) {
+            format_ = Format::Y4m;
+        } else if (ends_with(".raw")) {
+            format_ = Format::Raw;
+        } else if (ends_with(".png")) {
+            format_ = Format::Png;
+        } else {
+            log_error() << "Don't know how to write captures to " << path << ", expected .png, .y4m or .raw";
+            return false;
+        }
+        if (format_ == Format::Y4m || format_ == Format::Raw) {
+            stream_.open(path, std::ios::binary);
+            if (!stream_) {
+                log_error() << "Failed to open " << path << " for writing";
+                return false;
+            }
+        }
+        thread_ = std::thread([this] { run(); });
+        return true;
+    }
+
+    void submit(CaptureSlot *slot) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(slot);
+        }
+        cv_.notify_one();
+    }
+
+    // Writes out everything submitted so far, then stops the thread.
+    void stop() {
+        if (!thread_.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+        stream_.close();
+    }
+
+    // Only safe to read after stop().
+    uint64_t frames_written = 0;
+    // Read back but left out of the capture, so really dropped.
+    uint64_t frames_skipped = 0;
+    uint64_t bytes_encoded = 0;
+    double encode_seconds = 0.0;
+    bool failed = false;
+    // RGB copy of the most recent frame, if asked to keep it.
+    RgbImage last_frame;
+
+private:
+    void run() {
+        tracer.name_thread("Frame writer");
+        for (;;) {
+            CaptureSlot *slot;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+                if (queue_.empty()) {
+                    return;
+                }
+                slot = queue_.front();
+                queue_.pop_front();
+            }
+            TraceZone zone("Encode frame", static_cast<int64_t>(slot->frame));
+            auto start = std::chrono::steady_clock::now();
+            if (!failed) {
+                switch (write(*slot)) {
+                case WriteResult::Ok:
+                    break;
+                case WriteResult::Skipped:
+                    ++frames_skipped;
+                    break;
+                case WriteResult::Failed:
+                    log_warning() << "Failed to write captured frame " << slot->frame << ", giving up on capture";
+                    failed = true;
+                    break;
+                }
+            }
+            if (keep_last_frame_) {
+                const std::size_t pixels = static_cast<std::size_t>(slot->extent.width) * slot->extent.height;
+                last_frame.width = slot->extent.width;
+                last_frame.height = slot->extent.height;
+                last_frame.rgb.resize(pixels * 3);
+                for (std::size_t i = 0; i != pixels; ++i) {
+                    const uint8_t *px = slot->mapped + i * 4;
+                    last_frame.rgb[i * 3 + 0] = px[slot->bgra ? 2 : 0];
+                    last_frame.rgb[i * 3 + 1] = px[1];
+                    last_frame.rgb[i * 3 + 2] = px[slot->bgra ? 0 : 2];
+                }
+            }
+            encode_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            bytes_encoded += static_cast<uint64_t>(slot->extent.width) * slot->extent.height * 4;
+            slot->busy.store(false, std::memory_order_release);
+        }
+    }
+
+    enum class WriteResult { Ok, Skipped, Failed };
+
+    WriteResult write(const CaptureSlot &slot) {
+        const uint32_t width = slot.extent.width, height = slot.extent.height;
+        switch (format_) {
+        case Format::None:
+            return WriteResult::Ok;
+        case Format::Png: {
+            std::string path = path_.substr(0, path_.size() - 4);
+            std::string number = std::to_string(slot.frame);
+            path += "_" + std::string(number.size() < 6 ? 6 - number.size() : 0, '0') + number + ".png";
+            if (!write_png(path, slot.mapped, width, height, slot.bgra)) {
+                return WriteResult::Failed;
+            }
+            break;
+        }
+        case Format::Y4m: {
+            // Y4M can't change size mid-stream, so drop frames that don't
+            // match the first one (e.g. mid-resize).
+            if (frames_written == 0) {
+                y4m_extent_ = slot.extent;
+                stream_ << "YUV4MPEG2 W" << width << " H" << height << " F60:1 Ip A1:1 C444\n";
+            } else if (width != y4m_extent_.width || height != y4m_extent_.height) {
+                return WriteResult::Skipped;
+            }
+            // BT.601 limited range, full resolution chroma.
+            std::vector<uint8_t> planes(static_cast<std::size_t>(width) * height * 3);
+            uint8_t *y_plane = planes.data();
+            uint8_t *u_plane = y_plane + width * height;
+            uint8_t *v_plane = u_plane + width * height;
+            for (std::size_t i = 0; i != static_cast<std::size_t>(width) * height; ++i) {
+                const uint8_t *px = slot.mapped + i * 4;
+                const float r = px[slot.bgra ? 2 : 0], g = px[1], b = px[slot.bgra ? 0 : 2];
+                y_plane[i] = static_cast<uint8_t>(16.0f + 0.257f * r + 0.504f * g + 0.098f * b + 0.5f);
+                u_plane[i] = static_cast<uint8_t>(128.0f - 0.148f * r - 0.291f * g + 0.439f * b + 0.5f);
+                v_plane[i] = static_cast<uint8_t>(128.0f + 0.439f * r - 0.368f * g - 0.071f * b + 0.5f);
+            }
+            stream_ << "FRAME\n";
+            stream_.write(reinterpret_cast<const char *>(planes.data()), planes.size());
+            break;
+        }
+        case Format::Raw:
+            // Always RGBA so consumers don't need to know the swap chain format.
+            if (slot.bgra) {
+                std::vector<uint8_t> rgba(slot.mapped, slot.mapped + static_cast<std::size_t>(width) * height * 4);
+                for (std::size_t i = 0; i < rgba.size(); i += 4) {
+                    std::swap(rgba[i], rgba[i + 2]);
+                }
+                stream_.write(reinterpret_cast<const char *>(rgba.data()), rgba.size());
+            } else {
+                stream_.write(reinterpret_cast<const char *>(slot.mapped), static_cast<std::streamsize>(width) * height * 4);
+            }
+            break;
+        }
+        ++frames_written;
+        return format_ == Format::Png || stream_ ? WriteResult::Ok : WriteResult::Failed;
+    }
+
+    Format format_ = Format::Png;
+    std::string path_;
+    bool keep_last_frame_ = false;
+    std::ofstream stream_;
+    VkExtent2D y4m_extent_{};
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<CaptureSlot *> queue_;
+    bool stopping_ = false;
+};
+
+// A small LZ77 codec in the style of LZ4's block format, for asset bundles.
+// Each sequence is a token byte (literal count in the high nibble, match
+// length - 4 in the low one, 15 meaning more length bytes follow), the
+// literals, then a 16-bit little endian match offset. The last sequence is
+// literals only. It's not a great compressor, but it decompresses at memory
+// speed, which is what matters for loading.
+static constexpr std::size_t lz_min_match = 4;
+
+static void lz_put_length(std::vector<uint8_t> &out, std::size_t length) {
+    for (; length >= 255; length -= 255) {
+        out.push_back(255);
+    }
+    out.push_back(static_cast<uint8_t>(length));
+}
+
+static void lz_compress(const uint8_t *src, std::size_t size, std::vector<uint8_t> &out) {
+    auto read32 = [&](std::size_t i) {
+        uint32_t v;
+        std::memcpy(&v, src + i, 4);
+        return v;
+    };
+    // Most recent position of each hashed 4 bytes.
+    std::vector<int64_t> table(1 << 14, -1);
+    auto emit = [&](std::size_t literal_begin, std::size_t literal_count, std::size_t offset, std::size_t match_length) {
+        const std::size_t match_code = match_length ? match_length - lz_min_match : 0;
+        out.push_back(static_cast<uint8_t>((std::min<std::size_t>(literal_count, 15) << 4) | std::min<std::size_t>(match_code, 15)));
+        if (literal_count >= 15) {
+            lz_put_length(out, literal_count - 15);
+        }
+        out.insert(out.end(), src + literal_begin, src + literal_begin + literal_count);
+        if (match_length) {
+            out.push_back(static_cast<uint8_t>(offset));
+            out.push_back(static_cast<uint8_t>(offset >> 8));
+            if (match_code >= 15) {
+                lz_put_length(out, match_code - 15);
+            }
+        }
+    };
+
+    std::size_t anchor = 0, i = 0;
+    // Matches have to stop short of the end so the last sequence always has
+    // some literals.
+    const std::size_t match_end = size > 5 ? size - 5 : 0;
+    while (i + lz_min_match <= match_end) {
+        const uint32_t v = read32(i);
+        const std::size_t h = (v * 2654435761u) >> 18;
+        const int64_t candidate = table[h];
+        table[h] = static_cast<int64_t>(i);
+        if (candidate < 0 || i - candidate > 0xffff || read32(candidate) != v) {
+            ++i;
+            continue;
+        }
+        std::size_t length = lz_min_match;
+        while (i + length < match_end && src[candidate + length] == src[i + length]) {
+            ++length;
+        }
+        emit(anchor, i - anchor, i - candidate, length);
+        i += length;
+        anchor = i;
+    }
+    emit(anchor, size - anchor, 0, 0);
+}
+
+// Decompresses exactly `size` bytes into dst, failing on anything malformed
+// rather than reading or writing out of bounds.
+static bool lz_decompress(const uint8_t *src, std::size_t src_size, uint8_t *dst, std::size_t size) {
+    std::size_t ip = 0, op = 0;
+    auto get_length = [&](std::size_t &length) {
+        for (;;) {
+            if (ip == src_size) {
+                return false;
+            }
+            const uint8_t b = src[ip++];
+            length += b;
+            if (b != 255) {
+                return true;
+            }
+        }
+    };
+    while (ip < src_size) {
+        const uint8_t token = src[ip++];
+        std::size_t literals = token >> 4;
+        if (literals == 15 && !get_length(literals)) {
+            return false;
+        }
+        if (literals > src_size - ip || literals > size - op) {
+            return false;
+        }
+        std::memcpy(dst + op, src + ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == src_size) {
+            break;
+        }
+
+        if (src_size - ip < 2) {
+            return false;
+        }
+        const std::size_t offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        std::size_t length = token & 15;
+        if (length == 15 && !get_length(length)) {
+            return false;
+        }
+        length += lz_min_match;
+        if (offset == 0 || offset > op || length > size - op) {
+            return false;
+        }
+        if (offset >= length) {
+            std::memcpy(dst + op, dst + op - offset, length);
+        } else {
+            // Overlapping, i.e. a repeating pattern, so byte by byte.
+            for (std::size_t i = 0; i != length; ++i) {
+                dst[op + i] = dst[op - offset + i];
+            }
+        }
+        op += length;
+    }
+    return op == size;
+}
+
+// A fixed set of worker threads to split work like decompression into
+// independent pieces. parallel_for can be called from several threads at
+// once; the caller works on its own pieces alongside the workers and returns
+// once they're all done.
+class ThreadPool {
+public:
+    ThreadPool(std::size_t threads, const std::string &name) {
+        for (std::size_t i = 0; i != threads; ++i) {
+            workers_.emplace_back([this, name, i] {
+                tracer.name_thread((name + " " + std::to_string(i)).c_str());
+                work_loop();
+            });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        for (auto &worker : workers_) {
+            worker.join();
+        }
+    }
+
+    std::size_t size() const {
+        return workers_.size();
+    }
+
+    void parallel_for(std::size_t count, const std::function<void(std::size_t)> &fn) {
+        if (count == 0) {
+            return;
+        }
+        auto job = std::make_shared<Job>();
+        job->fn = &fn;
+        job->count = count;
+        if (count > 1) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                jobs_.push_back(job);
+            }
+            cv_.notify_all();
+        }
+        run(*job);
+        std::unique_lock<std::mutex> lock(job->mutex);
+        job->cv.wait(lock, [&] { return job->done == job->count; });
+    }
+
+private:
+    struct Job {
+        const std::function<void(std::size_t)> *fn;
+        std::size_t count;
+        std::atomic<std::size_t> next{0};
+        std::size_t done = 0;
+        std::mutex mutex;
+        std::condition_variable cv;
+    };
+
+    // Runs pieces of `job` until there are none left to claim.
+    static void run(Job &job) {
+        for (std::size_t i; (i = job.next.fetch_add(1)) < job.count; ) {
+            (*job.fn)(i);
+            std::lock_guard<std::mutex> lock(job.mutex);
+            if (++job.done == job.count) {
+                job.cv.notify_all();
+            }
+        }
+    }
+
+    void work_loop() {
+        for (;;) {
+            std::shared_ptr<Job> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+                if (stopping_) {
+                    return;
+                }
+                job = jobs_.front();
+                // Once every piece has been claimed there's nothing more
+                // for workers to do, even if some are still running.
+                if (job->next.load() >= job->count) {
+                    jobs_.pop_front();
+                    continue;
+                }
+            }
+            run(*job);
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::shared_ptr<Job>> jobs_;
+    bool stopping_ = false;
+};
+
+// A packed set of asset files: a table of contents, then each file split into
+// chunks that are compressed independently, so they can be read and
+// decompressed in parallel and any part of a file read without the rest.
+//
+// Chunks start on block_size boundaries and are padded out to them, so on
+// Linux they can be read with O_DIRECT, straight from the disk into our own
+// aligned buffers without going through (and evicting things from) the page
+// cache. Whole chunks decompress straight into the caller's memory.
+//
+// Layout, all little endian:
+//   "VKBUNDLE", u32 version, u32 file count
+//   per file: u16 name length, name, u64 size, u32 chunk count,
+//             per chunk: u64 offset, u32 stored size, u32 size
+//   chunk data
+// A chunk whose stored size equals its size didn't compress and is stored
+// as is.
+class AssetBundle {
+public:
+    static constexpr uint32_t chunk_size = 256 * 1024;
+    static constexpr uint64_t block_size = 4096;
+
+    struct Chunk {
+        uint64_t offset;
+        uint32_t stored_size;
+        uint32_t size;
+    };
+
+    struct Entry {
+        std::string name;
+        uint64_t size;
+        std::vector<Chunk> chunks;
+    };
+
+    AssetBundle() = default;
+    AssetBundle(const AssetBundle &) = delete;
+    AssetBundle &operator=(const AssetBundle &) = delete;
+
+    ~AssetBundle() {
+#ifdef __linux__
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+        if (direct_fd_ >= 0) {
+            ::close(direct_fd_);
+        }
+#endif
+    }
+
+    // Compresses `files` into a bundle at `path`, spreading chunks over
+    // `pool`. Files are named in the bundle by the paths given here.
+    static bool pack(const std::string &path, const std::vector<std::string> &files, ThreadPool &pool) {
+        const auto start = std::chrono::steady_clock::now();
+        struct Packed {
+            std::string name;
+            std::vector<char> bytes;
+            std::vector<std::vector<uint8_t>> chunks;
+        };
+        std::vector<Packed> packed;
+        std::vector<std::pair<std::size_t, std::size_t>> work;
+        uint64_t raw_bytes = 0;
+        for (const auto &name : files) {
+            std::ifstream file(name, std::ios::ate | std::ios::binary);
+            if (!file) {
+                log_error() << "Could not open " << name << " to pack";
+                return false;
+            }
+            Packed p{name, std::vector<char>(file.tellg()), {}};
+            file.seekg(0);
+            if (!file.read(p.bytes.data(), p.bytes.size())) {
+                log_error() << "Failed to read " << name << " to pack";
+                return false;
+            }
+            p.chunks.resize((p.bytes.size() + chunk_size - 1) / chunk_size);
+            for (std::size_t c = 0; c != p.chunks.size(); ++c) {
+                work.emplace_back(packed.size(), c);
+            }
+            raw_bytes += p.bytes.size();
+            packed.push_back(std::move(p));
+        }
+
+        pool.parallel_for(work.size(), [&](std::size_t i) {
+            Packed &p = packed[work[i].first];
+            const std::size_t begin = work[i].second * chunk_size;
+            const std::size_t size = std::min<std::size_t>(chunk_size, p.bytes.size() - begin);
+            const uint8_t *src = reinterpret_cast<const uint8_t *>(p.bytes.data()) + begin;
+            std::vector<uint8_t> &out = p.chunks[work[i].second];
+            lz_compress(src, size, out);
+            if (out.size() >= size) {
+                out.assign(src, src + size);
+            }
+        });
+
+        std::vector<uint8_t> toc;
+        auto put = [&](const void *v, std::size_t size) {
+            toc.insert(toc.end(), static_cast<const uint8_t *>(v), static_cast<const uint8_t *>(v) + size);
+        };
+        const uint32_t version = 1, count = static_cast<uint32_t>(packed.size());
+        put("VKBUNDLE", 8);
+        put(&version, 4);
+        put(&count, 4);
+        // The table's size doesn't depend on the offsets in it, so work
+        // out where the data starts first.
+        uint64_t toc_size = toc.size();
+        for (const auto &p : packed) {
+            toc_size += 2 + p.name.size() + 8 + 4 + p.chunks.size() * 16;
+        }
+        uint64_t offset = align(toc_size);
+        uint64_t packed_bytes = 0;
+        for (const auto &p : packed) {
+            const uint16_t name_size = static_cast<uint16_t>(p.name.size());
+            const uint64_t size = p.bytes.size();
+            const uint32_t chunk_count = static_cast<uint32_t>(p.chunks.size());
+            put(&name_size, 2);
+            put(p.name.data(), name_size);
+            put(&size, 8);
+            put(&chunk_count, 4);
+            for (std::size_t c = 0; c != p.chunks.size(); ++c) {
+                const uint32_t stored_size = static_cast<uint32_t>(p.chunks[c].size());
+                const uint32_t chunk_bytes = static_cast<uint32_t>(std::min<uint64_t>(chunk_size, size - c * chunk_size));
+                put(&offset, 8);
+                put(&stored_size, 4);
+                put(&chunk_bytes, 4);
+                offset += align(stored_size);
+                packed_bytes += stored_size;
+            }
+        }
+
+        std::ofstream out(path, std::ios::binary);
+        const std::vector<char> padding(block_size, 0);
+        out.write(reinterpret_cast<const char *>(toc.data()), toc.size());
+        out.write(padding.data(), align(toc.size()) - toc.size());
+        for (const auto &p : packed) {
+            for (const auto &chunk : p.chunks) {
+                out.write(reinterpret_cast<const char *>(chunk.data()), chunk.size());
+                out.write(padding.data(), align(chunk.size()) - chunk.size());
+            }
+        }
+        if (!out.flush()) {
+            log_error() << "Failed to write asset bundle " << path;
+            return false;
+        }
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        log_info() << "Packed " << packed.size() << " files into " << path << ": " << raw_bytes / (1024.0 * 1024.0) << " MiB to "
+                   << packed_bytes / (1024.0 * 1024.0) << " MiB in " << work.size() << " chunks, in " << ms << "ms with "
+                   << pool.size() << " threads";
+        return true;
+    }
+
+    // Reads the table of contents. Chunks are read on demand through `pool`.
+    bool open(const std::string &path, ThreadPool &pool) {
+        pool_ = &pool;
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            log_error() << "Could not open asset bundle " << path;
+            return false;
+        }
+        auto get = [&](void *v, std::size_t size) {
+            return static_cast<bool>(file.read(static_cast<char *>(v), size));
+        };
+        char magic[8];
+        uint32_t version = 0, count = 0;
+        if (!get(magic, 8) || std::memcmp(magic, "VKBUNDLE", 8) != 0 || !get(&version, 4) || version != 1 || !get(&count, 4)) {
+            log_error() << path << " is not an asset bundle";
+            return false;
+        }
+        uint64_t stored_bytes = 0;
+        entries_.resize(count);
+        for (auto &entry : entries_) {
+            uint16_t name_size = 0;
+            uint32_t chunk_count = 0;
+            if (!get(&name_size, 2)) {
+                break;
+            }
+            entry.name.resize(name_size);
+            if (!get(entry.name.data(), name_size) || !get(&entry.size, 8) || !get(&chunk_count, 4)) {
+                break;
+            }
+            uint64_t total = 0;
+            entry.chunks.resize(chunk_count);
+            for (auto &chunk : entry.chunks) {
+                if (!get(&chunk.offset, 8) || !get(&chunk.stored_size, 4) || !get(&chunk.size, 4) ||
+                    chunk.size > chunk_size || chunk.stored_size > chunk.size || chunk.offset % block_size != 0) {
+                    log_error() << "Bad chunk in asset bundle " << path;
+                    return false;
+                }
+                total += chunk.size;
+                stored_bytes += chunk.stored_size;
+            }
+            if (total != entry.size) {
+                log_error() << "Chunks don't add up for " << entry.name << " in asset bundle " << path;
+                return false;
+            }
+        }
+        if (!file) {
+            log_error() << "Truncated asset bundle " << path;
+            return false;
+        }
+
+#ifdef __linux__
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        direct_fd_ = ::open(path.c_str(), O_RDONLY | O_DIRECT);
+        if (fd_ < 0) {
+            log_error() << "Could not open asset bundle " << path;
+            return false;
+        }
+        // Some filesystems (tmpfs for one) accept O_DIRECT at open but not
+        // when reading, so try it before relying on it.
+        if (direct_fd_ >= 0 && !read_at(0, block_size, scratch(block_size))) {
+            ::close(direct_fd_);
+            direct_fd_ = -1;
+        }
+#else
+        file_.open(path, std::ios::binary);
+#endif
+        log_info() << "Opened asset bundle " << path << ": " << entries_.size() << " files, "
+                   << stored_bytes / (1024.0 * 1024.0) << " MiB packed, reading with " << pool.size() << " threads"
+                   << (direct_io() ? " and direct I/O" : "");
+        return true;
+    }
+
+    std::optional<std::size_t> find(const std::string &name) const {
+        for (std::size_t i = 0; i != entries_.size(); ++i) {
+            if (entries_[i].name == name) {
+                return i;
+            }
+        }
+        return std::nullopt;
+    }
+
+    const Entry &entry(std::size_t index) const {
+        return entries_[index];
+    }
+
+    std::size_t size() const {
+        return entries_.size();
+    }
+
+    // Reads `size` bytes from `offset` in an entry into dst, reading and
+    // decompressing the chunks that covers in parallel. Safe to call from
+    // several threads at once.
+    bool read(std::size_t index, uint64_t offset, uint64_t size, void *dst) {
+        const Entry &entry = entries_[index];
+        if (offset > entry.size || size > entry.size - offset) {
+            return false;
+        }
+        if (size == 0) {
+            return true;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        const std::size_t first = offset / chunk_size, last = (offset + size - 1) / chunk_size;
+        std::atomic<bool> ok{true};
+        pool_->parallel_for(last - first + 1, [&](std::size_t i) {
+            const std::size_t c = first + i;
+            const uint64_t chunk_begin = static_cast<uint64_t>(c) * chunk_size;
+            const uint64_t begin = std::max(offset, chunk_begin);
+            const uint64_t end = std::min(offset + size, chunk_begin + entry.chunks[c].size);
+            if (!read_chunk(entry.chunks[c], begin - chunk_begin, end - begin, static_cast<uint8_t *>(dst) + (begin - offset))) {
+                log_error() << "Failed to read chunk " << c << " of " << entry.name << " from asset bundle";
+                ok = false;
+            }
+        });
+        bytes_delivered_ += size;
+        wall_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        return ok;
+    }
+
+    std::vector<char> read_all(std::size_t index) {
+        std::vector<char> bytes(entries_[index].size);
+        if (!read(index, 0, bytes.size(), bytes.data())) {
+            throw std::runtime_error("Could not read " + entries_[index].name + " from asset bundle");
+        }
+        return bytes;
+    }
+
+    // Throughput of each stage. I/O and decompression are summed over the
+    // threads doing them, so are per thread; the overall rate is against
+    // time spent waiting in read().
+    void report() const {
+        auto mib = [](uint64_t bytes) { return bytes / (1024.0 * 1024.0); };
+        auto rate = [&](uint64_t bytes, uint64_t ns) { return ns ? mib(bytes) / (ns * 1e-9) : 0.0; };
+        std::cout << "Bundle: read " << mib(bytes_read_) << " MiB in " << chunks_read_ << " chunks at "
+                  << rate(bytes_read_, read_ns_) << " MiB/s per thread, decompressed " << mib(bytes_decompressed_) << " MiB at "
+                  << rate(bytes_decompressed_, decompress_ns_) << " MiB/s per thread, delivered " << mib(bytes_delivered_)
+                  << " MiB at " << rate(bytes_delivered_, wall_ns_) << " MiB/s overall with " << pool_->size() << " threads\n";
+    }
+
+private:
+    static uint64_t align(uint64_t bytes) {
+        return (bytes + block_size - 1) & ~(block_size - 1);
+    }
+
+    // Per-thread buffer for reads, aligned for O_DIRECT, grown as needed.
+    static uint8_t *scratch(std::size_t bytes) {
+        struct Scratch {
+            uint8_t *data = nullptr;
+            std::size_t size = 0;
+            ~Scratch() {
+                ::operator delete(data, std::align_val_t(block_size));
+            }
+        };
+        thread_local Scratch scratch;
+        if (scratch.size < bytes) {
+            ::operator delete(scratch.data, std::align_val_t(block_size));
+            scratch.data = static_cast<uint8_t *>(::operator new(bytes, std::align_val_t(block_size)));
+            scratch.size = bytes;
+        }
+        return scratch.data;
+    }
+
+    bool direct_io() const {
+#ifdef __linux__
+        return direct_fd_ >= 0;
+#else
+        return false;
+#endif
+    }
+
+    bool read_at(uint64_t offset, std::size_t size, uint8_t *dst) {
+#ifdef __linux__
+        const int fd = direct_fd_ >= 0 ? direct_fd_ : fd_;
+        for (std::size_t done = 0; done < size; ) {
+            const ssize_t n = ::pread(fd, dst + done, size - done, static_cast<off_t>(offset + done));
+            if (n <= 0) {
+                return false;
+            }
+            done += static_cast<std::size_t>(n);
+        }
+        return true;
+#else
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        file_.clear();
+        file_.seekg(static_cast<std::streamoff>(offset));
+        return static_cast<bool>(file_.read(reinterpret_cast<char *>(dst), size));
+#endif
+    }
+
+    // Reads `count` bytes from `skip` into a chunk. Whole chunks are
+    // decompressed straight into dst, partial ones via scratch space.
+    bool read_chunk(const Chunk &chunk, uint64_t skip, uint64_t count, uint8_t *dst) {
+        // Padding means whole blocks can always be read.
+        const std::size_t stored_span = align(chunk.stored_size);
+        uint8_t *stored = scratch(stored_span + chunk_size);
+        {
+            TraceZone zone("Read chunk");
+            const auto start = std::chrono::steady_clock::now();
+            if (!read_at(chunk.offset, direct_io() ? stored_span : chunk.stored_size, stored)) {
+                return false;
+            }
+            read_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            bytes_read_ += chunk.stored_size;
+            ++chunks_read_;
+        }
+        if (chunk.stored_size == chunk.size) {
+            std::memcpy(dst, stored + skip, count);
+            return true;
+        }
+
+        TraceZone zone("Decompress chunk");
+        const auto start = std::chrono::steady_clock::now();
+        const bool whole = skip == 0 && count == chunk.size;
+        uint8_t *out = whole ? dst : stored + stored_span;
+        if (!lz_decompress(stored, chunk.stored_size, out, chunk.size)) {
+            return false;
+        }
+        if (!whole) {
+            std::memcpy(dst, out + skip, count);
+        }
+        decompress_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        bytes_decompressed_ += chunk.size;
+        return true;
+    }
+
+    ThreadPool *pool_ = nullptr;
+    std::vector<Entry> entries_;
+#ifdef __linux__
+    int fd_ = -1;
+    int direct_fd_ = -1;
+#else
+    std::ifstream file_;
+    std::mutex file_mutex_;
+#endif
+
+    std::atomic<uint64_t> chunks_read_{0};
+    std::atomic<uint64_t> bytes_read_{0};
+    std::atomic<uint64_t> read_ns_{0};
+    std::atomic<uint64_t> bytes_decompressed_{0};
+    std::atomic<uint64_t> decompress_ns_{0};
+    std::atomic<uint64_t> bytes_delivered_{0};
+    std::atomic<uint64_t> wall_ns_{0};
+};
+
+// Streams textures onto the GPU a mip level at a time, coarsest first, so
+// that something is visible almost immediately and detail fills in after.
+//
+// Level data is read from disk or an asset bundle (or generated) on a loader
+// thread, then
+// uploaded through a per-frame staging buffer on the render thread. Without
+// sparse residency there's no way to free individual mips of an image, so
+// each texture's image only ever holds its resident levels: gaining or
+// losing a level means allocating a new image, copying the surviving levels
+// across and destroying the old one once the frame using it has finished.
+// That also means shaders can never sample a level that isn't there.
+class TextureStreamer {
+public:
+    struct Level {
+        // Where the level's data lives in the source file.
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    struct Texture {
+        std::string name;
+        // Empty for the generated checkerboard.
+        std::string path;
+        // Where to read it from instead of `path`, if it's in a bundle.
+        AssetBundle *bundle = nullptr;
+        std::size_t bundle_entry = 0;
+        VkFormat format;
+        VkExtent2D extent;
+        std::vector<Level> levels;
+        // Finest level resident, or levels.size() if none are.
+        uint32_t resident_top;
+        // Finest level worth having given how the texture is being drawn.
+        uint32_t wanted_top;
+        uint64_t last_used_frame = 0;
+        bool loading = false;
+
+        VkImage image = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkImageView view = VK_NULL_HANDLE;
+        VkDeviceSize memory_bytes = 0;
+
+        std::chrono::steady_clock::time_point created;
+        bool reported_complete = false;
+    };
+
+    TextureStreamer(VkDevice device, const VkAllocationCallbacks *allocator, const VkPhysicalDeviceMemoryProperties &mem_props,
+                    std::size_t frames_in_flight, VkDeviceSize budget_bytes, VkDeviceSize upload_budget_bytes)
+        : device_(device), allocator_(allocator), mem_props_(mem_props), staging_(frames_in_flight),
+          budget_bytes_(budget_bytes), upload_budget_bytes_(upload_budget_bytes) {}
+
+    ~TextureStreamer() {
+        stop();
+    }
+
+    // Adds a KTX2 file, from `bundle` if given. Only the header and level
+    // index are read here, the levels themselves are read as they're
+    // streamed in. Any format Vulkan can sample works, block compressed
+    // included, but supercompression and arrays/cubemaps/3D textures aren't
+    // supported.
+    bool add_ktx2(const std::string &path, AssetBundle *bundle = nullptr) {
+        std::ifstream file;
+        std::optional<std::size_t> entry;
+        if (bundle) {
+            entry = bundle->find(path);
+            if (!entry) {
+                log_error() << "Texture " << path << " isn't in the asset bundle";
+                return false;
+            }
+        } else {
+            file.open(path, std::ios::binary);
+            if (!file) {
+                log_error() << "Could not open texture " << path;
+                return false;
+            }
+        }
+        // Reads the next `size` bytes from wherever the file is.
+        uint64_t position = 0;
+        auto read = [&](void *dst, std::size_t size) {
+            if (entry) {
+                position += size;
+                return bundle->read(*entry, position - size, size, dst);
+            }
+            return static_cast<bool>(file.read(static_cast<char *>(dst), size));
+        };
+        static const uint8_t identifier[12] = {0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n'};
+        uint8_t header[80];
+        if (!read(header, sizeof(header)) || std::memcmp(header, identifier, 12) != 0) {
+            log_error() << path << " is not a KTX2 file";
+            return false;
+        }
+        auto u32 = [&](std::size_t offset) {
+            uint32_t v;
+            std::memcpy(&v, header + offset, 4);
+            return v;
+        };
+        const uint32_t vk_format = u32(12), width = u32(20), height = u32(24), depth = u32(28);
+        const uint32_t layers = u32(32), faces = u32(36), level_count = std::max(1u, u32(40)), supercompression = u32(44);
+        if (vk_format == VK_FORMAT_UNDEFINED || depth > 1 || layers > 1 || faces != 1 || supercompression != 0) {
+            log_error() << "Unsupported KTX2 texture " << path << ": only plain 2D textures without supercompression";
+            return false;
+        }
+
+        Texture texture;
+        texture.name = path;
+        texture.path = path;
+        texture.bundle = bundle;
+        texture.bundle_entry = entry.value_or(0);
+        texture.format = static_cast<VkFormat>(vk_format);
+        texture.extent = {width, height};
+        texture.levels.resize(level_count);
+        for (auto &level : texture.levels) {
+            uint64_t index[3];
+            if (!read(index, sizeof(index))) {
+                log_error() << "Truncated level index in " << path;
+                return false;
+            }
+            level = {index[0], index[1]};
+        }
+        add(std::move(texture));
+        return true;
+    }
+
+    // Adds a generated RGBA8 checkerboard with a full mip chain, streamed the
+    // same way as a file would be.
+    void add_checkerboard(uint32_t size) {
+        Texture texture;
+        texture.name = "checkerboard";
+        texture.format = VK_FORMAT_R8G8B8A8_UNORM;
+        texture.extent = {size, size};
+        for (uint32_t s = size; ; s /= 2) {
+            texture.levels.push_back({0, static_cast<uint64_t>(s) * s * 4});
+            if (s == 1) {
+                break;
+            }
+        }
+        add(std::move(texture));
+    }
+
+    // `on_loaded` is called from the loader thread whenever a level is ready
+    // to upload, so an idle render loop knows to wake up.
+    void start(std::function<void()> on_loaded = {}) {
+        on_loaded_ = std::move(on_loaded);
+        loader_ = std::thread([this] { load_loop(); });
+    }
+
+    void stop() {
+        if (!loader_.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_one();
+        loader_.join();
+    }
+
+    // Frees everything. The device must be idle.
+    void destroy() {
+        stop();
+        for (auto &texture : textures_) {
+            destroy_image(texture.image, texture.memory, texture.view);
+        }
+        for (auto &staging : staging_) {
+            if (staging.buffer != VK_NULL_HANDLE) {
+                vkUnmapMemory(device_, staging.memory);
+                vkDestroyBuffer(device_, staging.buffer, allocator_);
+                vkFreeMemory(device_, staging.memory, allocator_);
+            }
+        }
+    }
+
+    // Tells the streamer a texture is being drawn this frame, covering
+    // roughly `pixels` pixels across, which decides how much of it we want.
+    void mark_used(std::size_t index, float pixels, uint64_t frame) {
+        Texture &texture = textures_[index];
+        texture.last_used_frame = frame;
+        const float texels_per_pixel = texture.extent.width / std::max(pixels, 1.0f);
+        const uint32_t level = static_cast<uint32_t>(std::max(0.0f, std::floor(std::log2(texels_per_pixel))));
+        texture.wanted_top = std::min(level, static_cast<uint32_t>(texture.levels.size() - 1));
+    }
+
+    // Kicks off loads for missing levels and records uploads for any that
+    // have finished loading into `cmd`, which must be outside a render
+    // pass. Images replaced this frame are added to `deferred` to be
+    // destroyed once the frame completes.
+    bool update(VkCommandBuffer cmd, std::size_t frame_slot, uint64_t frame, std::vector<std::function<void()>> &deferred) {
+        // Uploads first, so that the next level of anything that's just
+        // landed gets asked for straight away.
+        if (!upload_loaded(cmd, frame_slot, deferred)) {
+            return false;
+        }
+        return request_loads(cmd, frame, deferred);
+    }
+
+    // Whether loaded levels are waiting on a frame to upload them, e.g. if
+    // there were more than the per-frame budget.
+    bool uploads_pending() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return !loaded_.empty();
+    }
+
+    const Texture &texture(std::size_t index) const {
+        return textures_[index];
+    }
+
+    std::size_t size() const {
+        return textures_.size();
+    }
+
+    VkDeviceSize resident_bytes() const {
+        VkDeviceSize total = 0;
+        for (const auto &texture : textures_) {
+            total += texture.memory_bytes;
+        }
+        return total;
+    }
+
+private:
+    struct LoadRequest {
+        std::size_t texture;
+        uint32_t level;
+        std::string path;
+        AssetBundle *bundle;
+        std::size_t bundle_entry;
+        Level source;
+        VkExtent2D extent;
+        std::chrono::steady_clock::time_point requested;
+    };
+
+    struct LoadedLevel {
+        std::size_t texture;
+        uint32_t level;
+        std::vector<uint8_t> bytes;
+        std::chrono::steady_clock::time_point requested;
+        double load_ms;
+    };
+
+    struct Staging {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        uint8_t *mapped = nullptr;
+        VkDeviceSize capacity = 0;
+    };
+
+    void add(Texture texture) {
+        texture.resident_top = static_cast<uint32_t>(texture.levels.size());
+        texture.wanted_top = texture.resident_top - 1;
+        texture.created = std::chrono::steady_clock::now();
+        textures_.push_back(std::move(texture));
+    }
+
+    static VkExtent2D level_extent(const Texture &texture, uint32_t level) {
+        return {std::max(1u, texture.extent.width >> level), std::max(1u, texture.extent.height >> level)};
+    }
+
+    // Rough size an image holding levels [top, end) will take.
+    static VkDeviceSize levels_bytes(const Texture &texture, uint32_t top) {
+        VkDeviceSize bytes = 0;
+        for (uint32_t level = top; level < texture.levels.size(); ++level) {
+            bytes += texture.levels[level].size;
+        }
+        return bytes;
+    }
+
+    // Records uploads for levels the loader has finished, up to the
+    // per-frame budget.
+    bool upload_loaded(VkCommandBuffer cmd, std::size_t frame_slot, std::vector<std::function<void()>> &deferred) {
+        std::deque<LoadedLevel> loaded;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            // Uploads are limited per frame so a burst of completed loads
+            // doesn't cause a hitch, but always do at least one.
+            VkDeviceSize bytes = 0;
+            while (!loaded_.empty() && (loaded.empty() || bytes + loaded_.front().bytes.size() <= upload_budget_bytes_)) {
+                bytes += loaded_.front().bytes.size();
+                loaded.push_back(std::move(loaded_.front()));
+                loaded_.pop_front();
+            }
+        }
+        if (loaded.empty()) {
+            return true;
+        }
+
+        Staging &staging = staging_[frame_slot];
+        VkDeviceSize needed = 0;
+        for (const auto &level : loaded) {
+            needed += (level.bytes.size() + 15) & ~VkDeviceSize(15);
+        }
+        if (staging.capacity < needed) {
+            // Safe to replace: the last frame to use this slot's staging
+            // buffer has finished.
+            if (staging.buffer != VK_NULL_HANDLE) {
+                vkUnmapMemory(device_, staging.memory);
+                vkDestroyBuffer(device_, staging.buffer, allocator_);
+                vkFreeMemory(device_, staging.memory, allocator_);
+            }
+            if (!create_buffer(staging.buffer, staging.memory, device_, allocator_, mem_props_, static_cast<uint32_t>(needed), VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+                return false;
+            }
+            void *ptr = nullptr;
+            if (vkMapMemory(device_, staging.memory, 0, VK_WHOLE_SIZE, 0, &ptr) != VK_SUCCESS) {
+                log_error() << "Failed to map texture staging buffer";
+                return false;
+            }
+            staging.mapped = static_cast<uint8_t *>(ptr);
+            staging.capacity = needed;
+        }
+
+        VkDeviceSize offset = 0;
+        for (auto &level : loaded) {
+            Texture &texture = textures_[level.texture];
+            texture.loading = false;
+            std::memcpy(staging.mapped + offset, level.bytes.data(), level.bytes.size());
+            if (!reallocate(texture, level.level, cmd, deferred, staging.buffer, offset)) {
+                return false;
+            }
+            offset += (level.bytes.size() + 15) & ~VkDeviceSize(15);
+
+            // Latency is from asking for the level to its upload being
+            // recorded; it'll be on screen when this frame is.
+            const auto now = std::chrono::steady_clock::now();
+            const VkExtent2D extent = level_extent(texture, level.level);
+            log_info() << "Texture " << texture.name << ": level " << level.level << " (" << extent.width << "x" << extent.height << ", "
+                       << level.bytes.size() / 1024 << " KiB) resident after "
+                       << std::chrono::duration<double, std::milli>(now - level.requested).count() << "ms (load "
+                       << level.load_ms << "ms), " << resident_bytes() / (1024.0 * 1024.0) << " MiB resident";
+            if (!texture.reported_complete && texture.resident_top <= texture.wanted_top) {
+                texture.reported_complete = true;
+                log_info() << "Texture " << texture.name << ": streamed to level " << texture.resident_top << " in "
+                           << std::chrono::duration<double, std::milli>(now - texture.created).count() << "ms";
+            }
+        }
+        return true;
+    }
+
+    // Asks the loader for the next finer level of each texture that wants
+    // one, most recently used textures first and coarse levels before fine
+    // ones, evicting from other textures if it would put us over budget.
+    bool request_loads(VkCommandBuffer cmd, uint64_t frame, std::vector<std::function<void()>> &deferred) {
+        std::vector<std::size_t> order(textures_.size());
+        for (std::size_t i = 0; i != order.size(); ++i) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+            const Texture &ta = textures_[a], &tb = textures_[b];
+            if (ta.last_used_frame != tb.last_used_frame) {
+                return ta.last_used_frame > tb.last_used_frame;
+            }
+            return ta.resident_top > tb.resident_top;
+        });
+
+        for (std::size_t index : order) {
+            Texture &texture = textures_[index];
+            if (texture.loading || texture.resident_top <= texture.wanted_top) {
+                continue;
+            }
+            const uint32_t level = texture.resident_top - 1;
+            const VkDeviceSize growth = texture.levels[level].size;
+            bool room = true;
+            if (resident_bytes() + growth > budget_bytes_ && !evict(growth, index, cmd, frame, deferred, room)) {
+                return false;
+            }
+            if (!room) {
+                continue;
+            }
+            texture.loading = true;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                requests_.push_back({index, level, texture.path, texture.bundle, texture.bundle_entry, texture.levels[level], level_extent(texture, level), std::chrono::steady_clock::now()});
+            }
+            cv_.notify_one();
+        }
+        return true;
+    }
+
+    // Frees at least `bytes` by dropping the finest levels of other textures,
+    // levels beyond what they want first, then least recently used. Every
+    // texture keeps at least its smallest level so it can always be drawn.
+    // Sets `room` to whether enough could be freed; returns false on error.
+    bool evict(VkDeviceSize bytes, std::size_t requester, VkCommandBuffer cmd, uint64_t frame,
+               std::vector<std::function<void()>> &deferred, bool &room) {
+        VkDeviceSize freed = 0;
+        while (freed < bytes) {
+            Texture *victim = nullptr;
+            for (std::size_t i = 0; i != textures_.size(); ++i) {
+                Texture &texture = textures_[i];
+                if (i == requester || texture.loading || texture.resident_top + 1 >= texture.levels.size()) {
+                    continue;
+                }
+                auto surplus = [](const Texture &t) { return t.resident_top < t.wanted_top; };
+                if (!victim ||
+                    (surplus(texture) && !surplus(*victim)) ||
+                    (surplus(texture) == surplus(*victim) && texture.last_used_frame < victim->last_used_frame)) {
+                    victim = &texture;
+                }
+            }
+            // Don't evict what's needed this frame just to make room for
+            // something else needed this frame.
+            if (!victim || (victim->last_used_frame == frame && victim->resident_top >= victim->wanted_top)) {
+                room = false;
+                return true;
+            }
+            freed += victim->levels[victim->resident_top].size;
+            log_info() << "Texture " << victim->name << ": evicting level " << victim->resident_top;
+            if (!reallocate(*victim, victim->resident_top + 1, cmd, deferred, VK_NULL_HANDLE, 0)) {
+                return false;
+            }
+        }
+        room = true;
+        return true;
+    }
+
+    // Replaces a texture's image with one holding levels [new_top, end).
+    // If new_top is one finer than what's resident, its data is at
+    // `staging_offset` in `staging`; if coarser, levels are dropped.
+    bool reallocate(Texture &texture, uint32_t new_top, VkCommandBuffer cmd, std::vector<std::function<void()>> &deferred,
+                    VkBuffer staging, VkDeviceSize staging_offset) {
+        const uint32_t level_count = static_cast<uint32_t>(texture.levels.size()) - new_top;
+        VkImage image;
+        VkDeviceMemory memory;
+        VkImageView view;
+        if (!create_image(image, memory, view, device_, allocator_, mem_props_, level_extent(texture, new_top), level_count, texture.format,
+                VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT)) {
+            return false;
+        }
+
+        std::vector<VkImageMemoryBarrier> barriers;
+        barriers.push_back({
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .pNext = NULL,
+            .srcAccessMask = 0,
+            .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = image,
+            .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, level_count, 0, 1},
+        });
+        const bool has_old = texture.image != VK_NULL_HANDLE;
+        if (has_old) {
+            // Earlier frames may still be sampling the old image; the barrier
+            // waits for them.
+            barriers.push_back({
+                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                .pNext = NULL,
+                .srcAccessMask = 0,
+                .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+                .oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .image = texture.image,
+                .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, 1},
+            });
+        }
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+            0, NULL, 0, NULL, static_cast<uint32_t>(barriers.size()), barriers.data());
+
+        // Carry over the levels both images share.
+        if (has_old) {
+            std::vector<VkImageCopy> copies;
+            for (uint32_t level = std::max(new_top, texture.resident_top); level < texture.levels.size(); ++level) {
+                const VkExtent2D extent = level_extent(texture, level);
+                copies.push_back({
+                    .srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - texture.resident_top, 0, 1},
+                    .srcOffset = {0, 0, 0},
+                    .dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - new_top, 0, 1},
+                    .dstOffset = {0, 0, 0},
+                    .extent = {extent.width, extent.height, 1},
+                });
+            }
+            vkCmdCopyImage(cmd, texture.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                static_cast<uint32_t>(copies.size()), copies.data());
+        }
+        if (new_top < texture.resident_top) {
+            const VkExtent2D extent = level_extent(texture, new_top);
+            VkBufferImageCopy region{
+                .bufferOffset = staging_offset,
+                .bufferRowLength = 0,
+                .bufferImageHeight = 0,
+                .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+                .imageOffset = {0, 0, 0},
+                .imageExtent = {extent.width, extent.height, 1},
+            };
+            vkCmdCopyBufferToImage(cmd, staging, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+        }
+
+        VkImageMemoryBarrier to_shader{
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .pNext = NULL,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = image,
+            .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, level_count, 0, 1},
+        };
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+            0, NULL, 0, NULL, 1, &to_shader);
+
+        if (has_old) {
+            deferred.push_back([this, old_image = texture.image, old_memory = texture.memory, old_view = texture.view]() mutable {
+                destroy_image(old_image, old_memory, old_view);
+            });
+        }
+        texture.image = image;
+        texture.memory = memory;
+        texture.view = view;
+        texture.resident_top = new_top;
+        texture.memory_bytes = levels_bytes(texture, new_top);
+        return true;
+    }
+
+    void destroy_image(VkImage &image, VkDeviceMemory &memory, VkImageView &view) {
+        if (image != VK_NULL_HANDLE) {
+            vkDestroyImageView(device_, view, allocator_);
+            vkDestroyImage(device_, image, allocator_);
+            vkFreeMemory(device_, memory, allocator_);
+            image = VK_NULL_HANDLE;
+        }
+    }
+
+    void load_loop() {
+        tracer.name_thread("Texture loader");
+        for (;;) {
+            LoadRequest request;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return stopping_ || !requests_.empty(); });
+                if (stopping_) {
+                    return;
+                }
+                request = std::move(requests_.front());
+                requests_.pop_front();
+            }
+
+            TraceZone zone("Load level", request.level);
+            const auto start = std::chrono::steady_clock::now();
+            std::vector<uint8_t> bytes(request.source.size);
+            if (request.path.empty()) {
+                // Checkerboard, 8 squares across at every level.
+                const uint32_t size = request.extent.width;
+                const uint32_t square = std::max(1u, size / 8);
+                for (uint32_t y = 0; y != size; ++y) {
+                    for (uint32_t x = 0; x != size; ++x) {
+                        const uint8_t v = ((x / square) + (y / square)) % 2 ? 255 : 64;
+                        std::memset(&bytes[(static_cast<std::size_t>(y) * size + x) * 4], v, 4);
+                    }
+                }
+            } else if (request.bundle) {
+                // Spread over the bundle's pool, so big levels load on every
+                // core rather than just this thread.
+                if (!request.bundle->read(request.bundle_entry, request.source.offset, request.source.size, bytes.data())) {
+                    log_error() << "Failed to read level " << request.level << " of " << request.path << " from asset bundle";
+                    continue;
+                }
+            } else {
+                std::ifstream file(request.path, std::ios::binary);
+                file.seekg(static_cast<std::streamoff>(request.source.offset));
+                if (!file.read(reinterpret_cast<char *>(bytes.data()), bytes.size())) {
+                    // Leave it loading forever rather than retrying every frame.
+                    log_error() << "Failed to read level " << request.level << " of " << request.path;
+                    continue;
+                }
+            }
+            const double load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                loaded_.push_back({request.texture, request.level, std::move(bytes), request.requested, load_ms});
+            }
+            if (on_loaded_) {
+                on_loaded_();
+            }
+        }
+    }
+
+    VkDevice device_;
+    const VkAllocationCallbacks *allocator_;
+    const VkPhysicalDeviceMemoryProperties &mem_props_;
+    std::vector<Staging> staging_;
+    VkDeviceSize budget_bytes_;
+    VkDeviceSize upload_budget_bytes_;
+
+    std::vector<Texture> textures_;
+
+    std::thread loader_;
+    std::function<void()> on_loaded_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<LoadRequest> requests_;
+    std::deque<LoadedLevel> loaded_;
+    bool stopping_ = false;
+};
+
+#ifdef SCENE_SSE2
+// sin and cos of four angles at once. Reduces each angle to within pi/4 of
+// the nearest multiple of pi/2, in three steps to keep precision, then uses
+// the Cephes minimax polynomials and swaps/negates by quadrant.
+static inline void sincos_ps(__m128 x, __m128 &s, __m128 &c) {
+    const __m128i one = _mm_set1_epi32(1), two = _mm_set1_epi32(2);
+    const __m128i q = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(0.636619772f)));
+    const __m128 qf = _mm_cvtepi32_ps(q);
+    __m128 r = _mm_sub_ps(x, _mm_mul_ps(qf, _mm_set1_ps(1.5703125f)));
+    r = _mm_sub_ps(r, _mm_mul_ps(qf, _mm_set1_ps(4.837512969970703125e-4f)));
+    r = _mm_sub_ps(r, _mm_mul_ps(qf, _mm_set1_ps(7.54978995489188216e-8f)));
+    const __m128 r2 = _mm_mul_ps(r, r);
+
+    __m128 sin_r = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(-1.9515295891e-4f), r2), _mm_set1_ps(8.3321608736e-3f));
+    sin_r = _mm_add_ps(_mm_mul_ps(sin_r, r2), _mm_set1_ps(-1.6666654611e-1f));
+    sin_r = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(sin_r, r2), r), r);
+    __m128 cos_r = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.443315711809948e-5f), r2), _mm_set1_ps(-1.388731625493765e-3f));
+    cos_r = _mm_add_ps(_mm_mul_ps(cos_r, r2), _mm_set1_ps(4.166664568298827e-2f));
+    cos_r = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(cos_r, r2), r2), _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(_mm_set1_ps(0.5f), r2)));
+
+    // Odd quadrants swap sin and cos; sin is negative in quadrants 2 and 3,
+    // cos in 1 and 2.
+    const __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(q, one), one));
+    const __m128 sin_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(q, two), 30));
+    const __m128 cos_sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(q, one), two), 30));
+    s = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, cos_r), _mm_andnot_ps(swap, sin_r)), sin_sign);
+    c = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, sin_r), _mm_andnot_ps(swap, cos_r)), cos_sign);
+}
+#endif
+
+// Axis aligned bounds, in NDC for scene objects.
+struct Aabb {
+    float min_x, min_y, max_x, max_y;
+};
+
+// Whether the point is on a quad `half_extent` across each way from its
+// origin, with the world transform as the two padded rows the vertex shader
+// takes.
+static bool quad_contains(const float *rows, float half_extent, float x, float y) {
+    // Back into the quad's space with the inverse of its world matrix.
+    const float det = rows[0] * rows[5] - rows[1] * rows[4];
+    if (det == 0.0f) {
+        return false;
+    }
+    const float dx = x - rows[2], dy = y - rows[6];
+    const float lx = (rows[5] * dx - rows[1] * dy) / det;
+    const float ly = (rows[0] * dy - rows[4] * dx) / det;
+    return std::abs(lx) <= half_extent && std::abs(ly) <= half_extent;
+}
+
+// Object transforms as a 2D scene graph. Each node has a position, rotation
+// (plus a spin, in radians per second) and scale relative to its parent, and
+// update() works out where everything ends up.
+//
+// Transforms are stored as structure of arrays, each component contiguous,
+// in an order chosen so the update can run four nodes at a time with SSE and
+// across threads: each root's subtree is contiguous, so subtrees can be
+// updated in parallel, and within a subtree nodes are sorted by depth, so a
+// run of nodes at one depth only depends on nodes already done.
+class Scene {
+public:
+    // Below this many nodes handing work to other threads costs more than it
+    // saves.
+    static constexpr std::size_t parallel_threshold = 16384;
+    // Every node is drawn as the unit quad centred on its origin, which is
+    // what bounds are worked out for.
+    static constexpr float half_extent = 0.5f;
+
+    // Adds a node, under `parent` if not negative, which must have been
+    // added already. Returns its index, which is where update() writes it.
+    uint32_t add(int32_t parent, float x, float y, float rotation, float scale_x, float scale_y, float spin = 0.0f) {
+        nodes_.push_back({parent, x, y, rotation, scale_x, scale_y, spin});
+        return static_cast<uint32_t>(nodes_.size() - 1);
+    }
+
+    std::size_t size() const {
+        return nodes_.size();
+    }
+
+    // Lays the nodes out for updating, and groups subtrees into batches of
+    // roughly even size, a few per thread so uneven ones balance out.
+    void build(std::size_t threads) {
+        const std::size_t n = nodes_.size();
+        std::vector<uint32_t> depth(n), root(n);
+        for (std::size_t i = 0; i != n; ++i) {
+            const int32_t parent = nodes_[i].parent;
+            depth[i] = parent < 0 ? 0 : depth[parent] + 1;
+            root[i] = parent < 0 ? static_cast<uint32_t>(i) : root[parent];
+        }
+        std::vector<uint32_t> order(n);
+        for (std::size_t i = 0; i != n; ++i) {
+            order[i] = static_cast<uint32_t>(i);
+        }
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return root[a] != root[b] ? root[a] < root[b] : depth[a] < depth[b];
+        });
+        slot_.resize(n);
+        for (std::size_t k = 0; k != n; ++k) {
+            slot_[order[k]] = static_cast<uint32_t>(k);
+        }
+
+        for (auto *v : {&x_, &y_, &rotation_, &spin_, &scale_x_, &scale_y_, &w00_, &w01_, &w10_, &w11_, &wx_, &wy_}) {
+            v->assign(n, 0.0f);
+        }
+        parent_.resize(n);
+        output_.resize(n);
+        runs_.clear();
+        batches_.clear();
+        const std::size_t batch_target = std::max<std::size_t>(1, n / (std::max<std::size_t>(threads, 1) * 4));
+        std::size_t batch_nodes = 0;
+        for (std::size_t k = 0; k != n; ++k) {
+            const uint32_t i = order[k];
+            const Node &node = nodes_[i];
+            x_[k] = node.x;
+            y_[k] = node.y;
+            rotation_[k] = node.rotation;
+            spin_[k] = node.spin;
+            scale_x_[k] = node.scale_x;
+            scale_y_[k] = node.scale_y;
+            parent_[k] = node.parent < 0 ? -1 : static_cast<int32_t>(slot_[node.parent]);
+            output_[k] = i;
+
+            const bool new_subtree = k == 0 || root[order[k - 1]] != root[i];
+            if (new_subtree || depth[order[k - 1]] != depth[i]) {
+                runs_.push_back({static_cast<uint32_t>(k), static_cast<uint32_t>(k), depth[i] == 0});
+            }
+            ++runs_.back().end;
+            // Batches only break between subtrees.
+            if (new_subtree && (batches_.empty() || batch_nodes >= batch_target)) {
+                batches_.push_back({static_cast<uint32_t>(runs_.size() - 1), 0});
+                batch_nodes = 0;
+            }
+            batches_.back().run_end = static_cast<uint32_t>(runs_.size());
+            ++batch_nodes;
+        }
+    }
+
+    // Works out every node's world transform at `time` seconds and writes it
+    // to dst + index * stride, as the two rows of a 2x3 matrix each padded
+    // to a vec4, which is what the vertex shader wants, and its bounds to
+    // bounds[index] if given. Batches are spread over `pool` if given; `simd`
+    // is just there to compare against.
+    void update(float time, uint8_t *dst, std::size_t stride, Aabb *bounds, ThreadPool *pool, bool simd = true) {
+        auto update_batch = [&](std::size_t b) {
+            for (uint32_t r = batches_[b].run_begin; r != batches_[b].run_end; ++r) {
+                const Run &run = runs_[r];
+                uint32_t i = run.begin;
+#ifdef SCENE_SSE2
+                for (; simd && i + 4 <= run.end; i += 4) {
+                    update4(i, run.root, time, dst, stride);
+                }
+#endif
+                for (; i != run.end; ++i) {
+                    update1(i, run.root, time, dst, stride);
+                }
+                if (bounds) {
+                    for (uint32_t k = run.begin; k != run.end; ++k) {
+                        // How far the corners reach along each axis.
+                        const float hx = half_extent * (std::abs(w00_[k]) + std::abs(w01_[k]));
+                        const float hy = half_extent * (std::abs(w10_[k]) + std::abs(w11_[k]));
+                        bounds[output_[k]] = {wx_[k] - hx, wy_[k] - hy, wx_[k] + hx, wy_[k] + hy};
+                    }
+                }
+            }
+        };
+        if (pool && nodes_.size() >= parallel_threshold) {
+            pool->parallel_for(batches_.size(), update_batch);
+        } else {
+            for (std::size_t b = 0; b != batches_.size(); ++b) {
+                update_batch(b);
+            }
+        }
+    }
+
+    // Whether the point is on node `index` as of the last update, for when
+    // its bounds say it might be.
+    bool contains(uint32_t index, float x, float y) const {
+        const uint32_t k = slot_[index];
+        const float rows[8] = {w00_[k], w01_[k], wx_[k], 0.0f, w10_[k], w11_[k], wy_[k], 0.0f};
+        return quad_contains(rows, half_extent, x, y);
+    }
+
+private:
+    struct Node {
+        int32_t parent;
+        float x, y, rotation, scale_x, scale_y, spin;
+    };
+    // Nodes in one subtree at one depth.
+    struct Run {
+        uint32_t begin, end;
+        bool root;
+    };
+    struct Batch {
+        uint32_t run_begin, run_end;
+    };
+
+    void update1(uint32_t i, bool root, float time, uint8_t *dst, std::size_t stride) {
+        const float angle = rotation_[i] + spin_[i] * time;
+        const float c = std::cos(angle), s = std::sin(angle);
+        // Rotation times scale.
+        const float l00 = scale_x_[i] * c, l01 = -scale_y_[i] * s, l10 = scale_x_[i] * s, l11 = scale_y_[i] * c;
+        if (root) {
+            w00_[i] = l00, w01_[i] = l01, w10_[i] = l10, w11_[i] = l11, wx_[i] = x_[i], wy_[i] = y_[i];
+        } else {
+            const int32_t p = parent_[i];
+            w00_[i] = w00_[p] * l00 + w01_[p] * l10;
+            w01_[i] = w00_[p] * l01 + w01_[p] * l11;
+            w10_[i] = w10_[p] * l00 + w11_[p] * l10;
+            w11_[i] = w10_[p] * l01 + w11_[p] * l11;
+            wx_[i] = w00_[p] * x_[i] + w01_[p] * y_[i] + wx_[p];
+            wy_[i] = w10_[p] * x_[i] + w11_[p] * y_[i] + wy_[p];
+        }
+        if (dst) {
+            const float rows[8] = {w00_[i], w01_[i], wx_[i], 0.0f, w10_[i], w11_[i], wy_[i], 0.0f};
+            std::memcpy(dst + output_[i] * stride, rows, sizeof(rows));
+        }
+    }
+
+#ifdef SCENE_SSE2
+    void update4(uint32_t i, bool root, float time, uint8_t *dst, std::size_t stride) {
+        const __m128 angle = _mm_add_ps(_mm_loadu_ps(&rotation_[i]), _mm_mul_ps(_mm_loadu_ps(&spin_[i]), _mm_set1_ps(time)));
+        __m128 s, c;
+        sincos_ps(angle, s, c);
+        const __m128 scale_x = _mm_loadu_ps(&scale_x_[i]), scale_y = _mm_loadu_ps(&scale_y_[i]);
+        const __m128 l00 = _mm_mul_ps(scale_x, c);
+        const __m128 l01 = _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(scale_y, s));
+        const __m128 l10 = _mm_mul_ps(scale_x, s);
+        const __m128 l11 = _mm_mul_ps(scale_y, c);
+        const __m128 x = _mm_loadu_ps(&x_[i]), y = _mm_loadu_ps(&y_[i]);
+        __m128 w00 = l00, w01 = l01, w10 = l10, w11 = l11, wx = x, wy = y;
+        if (!root) {
+            // Parents can be anywhere earlier, so gather them.
+            const int32_t *p = &parent_[i];
+            auto gather = [&](const std::vector<float> &v) {
+                return _mm_setr_ps(v[p[0]], v[p[1]], v[p[2]], v[p[3]]);
+            };
+            const __m128 p00 = gather(w00_), p01 = gather(w01_), p10 = gather(w10_), p11 = gather(w11_);
+            w00 = _mm_add_ps(_mm_mul_ps(p00, l00), _mm_mul_ps(p01, l10));
+            w01 = _mm_add_ps(_mm_mul_ps(p00, l01), _mm_mul_ps(p01, l11));
+            w10 = _mm_add_ps(_mm_mul_ps(p10, l00), _mm_mul_ps(p11, l10));
+            w11 = _mm_add_ps(_mm_mul_ps(p10, l01), _mm_mul_ps(p11, l11));
+            wx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p00, x), _mm_mul_ps(p01, y)), gather(wx_));
+            wy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p10, x), _mm_mul_ps(p11, y)), gather(wy_));
+        }
+        _mm_storeu_ps(&w00_[i], w00);
+        _mm_storeu_ps(&w01_[i], w01);
+        _mm_storeu_ps(&w10_[i], w10);
+        _mm_storeu_ps(&w11_[i], w11);
+        _mm_storeu_ps(&wx_[i], wx);
+        _mm_storeu_ps(&wy_[i], wy);
+        if (dst) {
+            // Transpose to one matrix per register pair and write those out.
+            __m128 zero0 = _mm_setzero_ps(), zero1 = _mm_setzero_ps();
+            _MM_TRANSPOSE4_PS(w00, w01, wx, zero0);
+            _MM_TRANSPOSE4_PS(w10, w11, wy, zero1);
+            const __m128 row0[4] = {w00, w01, wx, zero0}, row1[4] = {w10, w11, wy, zero1};
+            for (int k = 0; k != 4; ++k) {
+                float *out = reinterpret_cast<float *>(dst + output_[i + k] * stride);
+                _mm_storeu_ps(out, row0[k]);
+                _mm_storeu_ps(out + 4, row1[k]);
+            }
+        }
+    }
+#endif
+
+    std::vector<Node> nodes_;
+    // Local transforms and world results, in update order.
+    std::vector<float> x_, y_, rotation_, spin_, scale_x_, scale_y_;
+    std::vector<float> w00_, w01_, w10_, w11_, wx_, wy_;
+    std::vector<int32_t> parent_;
+    // Index as added, i.e. where to write each node, and the other way.
+    std::vector<uint32_t> output_;
+    std::vector<uint32_t> slot_;
+    std::vector<Run> runs_;
+    std::vector<Batch> batches_;
+};
+
+// The quads we draw, tiled in a grid in NDC. Each row hangs off its first
+// quad, so spinning the scene swings whole rows about it as well as spinning
+// each quad.
+static void build_grid_scene(Scene &scene, uint32_t n_objects, float spin) {
+    const uint32_t grid_columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(n_objects))));
+    const uint32_t grid_rows = (n_objects + grid_columns - 1) / grid_columns;
+    // The quad is 1 unit across in NDC; leave a gap between tiles.
+    const float scale_x = std::min(1.0f, 1.8f / grid_columns), scale_y = std::min(1.0f, 1.8f / grid_rows);
+    int32_t row_root = -1;
+    float root_x = 0.0f;
+    for (uint32_t i = 0; i != n_objects; ++i) {
+        const float x = n_objects == 1 ? 0.0f : -1.0f + (2.0f * (i % grid_columns) + 1.0f) / grid_columns;
+        const float y = n_objects == 1 ? 0.0f : -1.0f + (2.0f * (i / grid_columns) + 1.0f) / grid_rows;
+        if (i % grid_columns == 0) {
+            row_root = static_cast<int32_t>(scene.add(-1, x, y, 0.0f, scale_x, scale_y, spin));
+            root_x = x;
+        } else {
+            // In the root's space, which is scaled.
+            scene.add(row_root, (x - root_x) / scale_x, 0.0f, 0.0f, 1.0f, 1.0f, spin);
+        }
+    }
+}
+
+// Hands the latest of a stream of values from one thread to another without
+// either ever waiting. Of the three copies, the writer fills one, the reader
+// holds another and the third sits between them. Publishing swaps the
+// writer's copy for the middle one, and the reader swaps its copy for the
+// middle one if anything has been published since it last looked.
+template <typename T>
+class TripleBuffer {
+public:
+    // The writer's copy, to fill in then publish().
+    T &back() {
+        return slots_[back_];
+    }
+
+    void publish() {
+        back_ = middle_.exchange(back_ | fresh_bit, std::memory_order_acq_rel) & index_mask;
+    }
+
+    // Takes the latest published copy, if there's a new one. Returns
+    // whether there was.
+    bool update() {
+        if (!(middle_.load(std::memory_order_relaxed) & fresh_bit)) {
+            return false;
+        }
+        front_ = middle_.exchange(front_, std::memory_order_acq_rel) & index_mask;
+        return true;
+    }
+
+    // The reader's copy. Nothing else touches it until the next update(),
+    // so the reader is free to swap its contents out.
+    T &front() {
+        return slots_[front_];
+    }
+
+private:
+    static constexpr uint32_t index_mask = 3, fresh_bit = 4;
+    T slots_[3];
+    uint32_t back_ = 0, front_ = 1;
+    // Index of the middle copy, plus fresh_bit if the writer put it there.
+    std::atomic<uint32_t> middle_{2};
+};
+
+// Steps the scene at a fixed rate on a thread of its own, so a slow frame
+// doesn't slow the simulation down, or a slow tick the rendering. Each tick's
+// transforms are published through a triple buffer, and the renderer draws
+// the scene one tick behind, interpolating between the last two ticks it
+// has.
+class Simulation {
+public:
+    struct Snapshot {
+        uint64_t tick = 0;
+        // When the tick is for, in seconds since start().
+        double time = 0.0;
+        // Each object's world transform as the vertex shader wants it, two
+        // padded rows apiece.
+        std::vector<float> rows;
+    };
+    static constexpr std::size_t floats_per_object = 8;
+    // Ticks we can fall behind by before giving up on catching up and
+    // dropping them.
+    static constexpr uint64_t max_catch_up = 4;
+
+    ~Simulation() {
+        stop();
+    }
+
+    // The scene belongs to the simulation thread from here until stop().
+    // Tick 0 is done before returning, so there's always a snapshot.
+    void start(Scene &scene, double rate, ThreadPool *pool) {
+        scene_ = &scene;
+        pool_ = pool;
+        tick_seconds_ = 1.0 / rate;
+        begin_ = std::chrono::steady_clock::now();
+        step(0);
+        thread_ = std::thread([this] { run(); });
+    }
+
+    void stop() {
+        if (!thread_.joinable()) {
+            return;
+        }
+        stopping_ = true;
+        thread_.join();
+    }
+
+    double tick_seconds() const {
+        return tick_seconds_;
+    }
+
+    // Seconds since start(), on the simulation's clock.
+    double now() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin_).count();
+    }
+
+    // Writes the transforms `alpha` of the way from `from` to `to` to dst +
+    // index * stride, and their bounds to bounds[index]. Lerping the matrices
+    // isn't a rotation, but over one tick's worth of spin it's near enough.
+    static void interpolate(const Snapshot &from, const Snapshot &to, float alpha, uint8_t *dst, std::size_t stride, Aabb *bounds, ThreadPool *pool) {
+        const std::size_t n = to.rows.size() / floats_per_object;
+        const bool lerp = from.rows.size() == to.rows.size() && alpha < 1.0f;
+        const std::size_t chunk = 4096;
+        auto interpolate_chunk = [&](std::size_t c) {
+            for (std::size_t i = c * chunk; i != std::min(n, (c + 1) * chunk); ++i) {
+                const float *b = &to.rows[i * floats_per_object];
+                float rows[floats_per_object];
+                if (lerp) {
+                    const float *a = &from.rows[i * floats_per_object];
+                    for (std::size_t k = 0; k != floats_per_object; ++k) {
+                        rows[k] = a[k] + (b[k] - a[k]) * alpha;
+                    }
+                } else {
+                    std::memcpy(rows, b, sizeof(rows));
+                }
+                std::memcpy(dst + i * stride, rows, sizeof(rows));
+                const float hx = Scene::half_extent * (std::abs(rows[0]) + std::abs(rows[1]));
+                const float hy = Scene::half_extent * (std::abs(rows[4]) + std::abs(rows[5]));
+                bounds[i] = {rows[2] - hx, rows[6] - hy, rows[2] + hx, rows[6] + hy};
+            }
+        };
+        const std::size_t chunks = (n + chunk - 1) / chunk;
+        if (pool && n >= Scene::parallel_threshold) {
+            pool->parallel_for(chunks, interpolate_chunk);
+        } else {
+            for (std::size_t c = 0; c != chunks; ++c) {
+                interpolate_chunk(c);
+            }
+        }
+    }
+
+    TripleBuffer<Snapshot> snapshots;
+
+    // Only safe to read after stop(). Jitter is how late each tick started.
+    uint64_t ticks = 0, ticks_dropped = 0;
+    double tick_seconds_total = 0.0, run_seconds = 0.0;
+    double jitter_ms_total = 0.0, jitter_ms_max = 0.0;
+
+private:
+    void step(uint64_t tick) {
+        Snapshot &snapshot = snapshots.back();
+        snapshot.tick = tick;
+        snapshot.time = tick * tick_seconds_;
+        snapshot.rows.resize(scene_->size() * floats_per_object);
+        scene_->update(static_cast<float>(snapshot.time), reinterpret_cast<uint8_t *>(snapshot.rows.data()),
+            floats_per_object * sizeof(float), nullptr, pool_);
+        snapshots.publish();
+    }
+
+    void run() {
+        tracer.name_thread("Simulation");
+        uint64_t tick = 1;
+        while (!stopping_.load(std::memory_order_relaxed)) {
+            // Ticks are scheduled off the start time, not the last tick, so
+            // lateness doesn't build up.
+            const auto due = begin_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(tick * tick_seconds_));
+            std::this_thread::sleep_until(due);
+            const auto woke = std::chrono::steady_clock::now();
+            const double late_ms = std::chrono::duration<double, std::milli>(woke - due).count();
+            jitter_ms_total += late_ms;
+            jitter_ms_max = std::max(jitter_ms_max, late_ms);
+            const uint64_t behind = static_cast<uint64_t>(late_ms / 1e3 / tick_seconds_);
+            if (behind > max_catch_up) {
+                ticks_dropped += behind;
+                tick += behind;
+            }
+            {
+                TraceZone zone("Simulation tick", static_cast<int64_t>(tick));
+                step(tick);
+            }
+            tick_seconds_total += std::chrono::duration<double>(std::chrono::steady_clock::now() - woke).count();
+            ++ticks;
+            ++tick;
+        }
+        run_seconds = now();
+    }
+
+    Scene *scene_ = nullptr;
+    ThreadPool *pool_ = nullptr;
+    double tick_seconds_ = 0.0;
+    std::chrono::steady_clock::time_point begin_;
+    std::thread thread_;
+    std::atomic<bool> stopping_{false};
+};
+
+// What to cull against: up to four planes, with a point inside one when
+// nx * x + ny * y + d >= 0. Everything's drawn straight in NDC, so for now
+// that's just the edges of the screen.
+struct Frustum {
+    float nx[4], ny[4], d[4];
+
+    static Frustum ndc() {
+        return {{1.0f, -1.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 1.0f, -1.0f}, {1.0f, 1.0f, 1.0f, 1.0f}};
+    }
+};
+
+// Bounding volume hierarchy over the scene's objects, for culling and
+// picking.
+//
+// Trees are built with the surface area heuristic (perimeter, in 2D),
+// binning centroids along each axis and taking the cheapest split. As things
+// move refit() just grows and shrinks the boxes to fit, which is cheap but
+// leaves the tree shaped for where they used to be, so once its cost has
+// got far enough above what it was a new tree is built on a background
+// thread and swapped in when done.
+class Bvh {
+public:
+    // How much worse than when built the tree can get before it's rebuilt.
+    static constexpr float rebuild_ratio = 1.5f;
+
+    Bvh() = default;
+    Bvh(const Bvh &) = delete;
+    Bvh &operator=(const Bvh &) = delete;
+    ~Bvh() {
+        stop();
+    }
+
+    // Builds the tree over `bounds` here and now.
+    void build(const std::vector<Aabb> &bounds) {
+        tree_ = build_tree(bounds);
+        built_cost_ = tree_.cost;
+    }
+
+    // Fits the boxes to `bounds`, which must be for the same objects as
+    // built with, and swaps in or kicks off a rebuild as needed.
+    void refit(const std::vector<Aabb> &bounds) {
+        // A rebuilt tree was built from bounds a few frames old, but it's
+        // the same objects so refitting sorts it out.
+        bool swapped = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (rebuilt_) {
+                tree_ = std::move(*rebuilt_);
+                rebuilt_.reset();
+                rebuilding_ = false;
+                swapped = true;
+            }
+        }
+        // Children always come after their parents.
+        for (std::size_t i = tree_.nodes.size(); i-- != 0;) {
+            Node &node = tree_.nodes[i];
+            if (node.leaf()) {
+                node.box = empty_box;
+                for (uint32_t k = node.first; k != node.first + node.count; ++k) {
+                    node.box = merge(node.box, bounds[tree_.indices[k]]);
+                }
+            } else {
+                node.box = merge(tree_.nodes[node.child].box, tree_.nodes[node.child + 1].box);
+            }
+        }
+        tree_.cost = tree_cost(tree_);
+        if (swapped) {
+            built_cost_ = tree_.cost;
+        } else if (!rebuilding_ && tree_.cost > built_cost_ * rebuild_ratio) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                pending_ = bounds;
+            }
+            rebuilding_ = true;
+            if (!thread_.joinable()) {
+                thread_ = std::thread([this] { rebuild_loop(); });
+            }
+            cv_.notify_one();
+        }
+    }
+
+    // Fills `visible` with every object whose bounds overlap the frustum,
+    // in index order so draws keep theirs. Whole subtrees inside it are
+    // taken without looking at their objects.
+    void cull(const Frustum &frustum, const std::vector<Aabb> &bounds, std::vector<uint32_t> &visible) {
+        visible.clear();
+        if (tree_.nodes.empty()) {
+            return;
+        }
+        flags_.assign(tree_.indices.size(), 0);
+        stack_.assign(1, 0);
+        while (!stack_.empty()) {
+            const Node &node = tree_.nodes[stack_.back()];
+            stack_.pop_back();
+            const Overlap overlap = classify(frustum, node.box);
+            if (overlap == Overlap::outside) {
+                continue;
+            }
+            if (overlap == Overlap::inside) {
+                for (uint32_t k = node.first; k != node.first + node.count; ++k) {
+                    flags_[tree_.indices[k]] = 1;
+                }
+            } else if (node.leaf()) {
+                for (uint32_t k = node.first; k != node.first + node.count; ++k) {
+                    const uint32_t i = tree_.indices[k];
+                    flags_[i] = classify(frustum, bounds[i]) != Overlap::outside;
+                }
+            } else {
+                stack_.push_back(node.child);
+                stack_.push_back(node.child + 1);
+            }
+        }
+        for (uint32_t i = 0; i != flags_.size(); ++i) {
+            if (flags_[i]) {
+                visible.push_back(i);
+            }
+        }
+    }
 
-static std::vector<char> read_bytes(const char *file_path) {
-    std::ifstream file(file_path, std::ios::ate | std::ios::binary);
-    if (!file) {
-        throw std::logic_error(std::string("Could not find file ") + file_path); 
+    // The object drawn on top at a point, i.e. the last in index order whose
+    // bounds contain it and that `hit` agrees is under it, or -1 if none.
+    template <typename Hit>
+    int64_t pick(float x, float y, const std::vector<Aabb> &bounds, Hit &&hit) const {
+        auto contains = [&](const Aabb &box) {
+            return x >= box.min_x && x <= box.max_x && y >= box.min_y && y <= box.max_y;
+        };
+        int64_t best = -1;
+        if (tree_.nodes.empty()) {
+            return best;
+        }
+        std::vector<uint32_t> stack{0};
+        while (!stack.empty()) {
+            const Node &node = tree_.nodes[stack.back()];
+            stack.pop_back();
+            if (!contains(node.box)) {
+                continue;
+            }
+            if (node.leaf()) {
+                for (uint32_t k = node.first; k != node.first + node.count; ++k) {
+                    const uint32_t i = tree_.indices[k];
+                    if (static_cast<int64_t>(i) > best && contains(bounds[i]) && hit(i)) {
+                        best = i;
+                    }
+                }
+            } else {
+                stack.push_back(node.child);
+                stack.push_back(node.child + 1);
+            }
+        }
+        return best;
     }
-    std::vector<char> bytes(file.tellg());
-    file.seekg(0);
-    file.read(bytes.data(), bytes.size());
-    file.close();
-    return bytes;
-}
 
-static bool create_buffer(VkBuffer &b, VkDeviceMemory &mem,
-    const VkDevice &device, const VkPhysicalDeviceMemoryProperties &mem_props, uint32_t bytes, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties) {
-    VkBufferCreateInfo buffer_info{
-        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .pNext = NULL,
-        .flags = 0,
-        .size = bytes,
-        .usage = usage,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    std::size_t nodes() const {
+        return tree_.nodes.size();
+    }
+
+    // Surface area heuristic cost as of the last build or refit, relative
+    // to the root.
+    float cost() const {
+        return tree_.cost;
+    }
+
+    // Lets any rebuild in progress finish, then stops the thread.
+    void stop() {
+        if (!thread_.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+    }
+
+    // Only safe to read after stop().
+    uint64_t rebuilds = 0;
+    double rebuild_seconds = 0.0;
+
+private:
+    struct Node {
+        Aabb box;
+        // Internal nodes have children at child and child + 1, leaves a
+        // child of 0, which is always the root. Either way the objects under
+        // the node are indices[first, first + count).
+        uint32_t child, first, count;
+
+        bool leaf() const {
+            return child == 0;
+        }
     };
-    VkResult result;
-    if ((result = vkCreateBuffer(device, &buffer_info, nullptr, &b)) != VK_SUCCESS) {
-        std::cerr << "Failed to create buffer: " << string_VkResult(result) << "\n";
-        return false;
+    struct Tree {
+        std::vector<Node> nodes;
+        std::vector<uint32_t> indices;
+        float cost = 0.0f;
+    };
+    enum class Overlap {
+        outside,
+        partial,
+        inside,
+    };
+
+    // Nodes with more objects than this are always split, and with this few
+    // never are.
+    static constexpr uint32_t max_leaf_size = 8;
+    static constexpr uint32_t min_leaf_size = 2;
+    static constexpr int bin_count = 16;
+    static constexpr Aabb empty_box = {
+        std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+        std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(),
+    };
+
+    static Aabb merge(const Aabb &a, const Aabb &b) {
+        return {std::min(a.min_x, b.min_x), std::min(a.min_y, b.min_y), std::max(a.max_x, b.max_x), std::max(a.max_y, b.max_y)};
     }
 
-    VkMemoryRequirements mem_req;
-    vkGetBufferMemoryRequirements(device, b, &mem_req);
+    static float half_perimeter(const Aabb &box) {
+        return (box.max_x - box.min_x) + (box.max_y - box.min_y);
+    }
+
+    static float tree_cost(const Tree &tree) {
+        if (tree.nodes.empty()) {
+            return 0.0f;
+        }
+        float cost = 0.0f;
+        for (const Node &node : tree.nodes) {
+            cost += half_perimeter(node.box) * (node.leaf() ? node.count : 1);
+        }
+        return cost / std::max(half_perimeter(tree.nodes[0].box), 1e-12f);
+    }
 
+    static Overlap classify(const Frustum &frustum, const Aabb &box) {
+        // The corner furthest along a plane's normal decides whether the box
+        // is outside it, and the nearest whether it's all inside.
+#ifdef SCENE_SSE2
+        // All four planes at once.
+        const __m128 nx = _mm_loadu_ps(frustum.nx), ny = _mm_loadu_ps(frustum.ny), d = _mm_loadu_ps(frustum.d);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 x_up = _mm_cmpge_ps(nx, zero), y_up = _mm_cmpge_ps(ny, zero);
+        auto select = [](__m128 mask, __m128 a, __m128 b) {
+            return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+        };
+        const __m128 min_x = _mm_set1_ps(box.min_x), min_y = _mm_set1_ps(box.min_y);
+        const __m128 max_x = _mm_set1_ps(box.max_x), max_y = _mm_set1_ps(box.max_y);
+        const __m128 far = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, select(x_up, max_x, min_x)), _mm_mul_ps(ny, select(y_up, max_y, min_y))), d);
+        const __m128 near = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, select(x_up, min_x, max_x)), _mm_mul_ps(ny, select(y_up, min_y, max_y))), d);
+        if (_mm_movemask_ps(_mm_cmplt_ps(far, zero))) {
+            return Overlap::outside;
+        }
+        return _mm_movemask_ps(_mm_cmplt_ps(near, zero)) ? Overlap::partial : Overlap::inside;
+#else
+        Overlap overlap = Overlap::inside;
+        for (int p = 0; p != 4; ++p) {
+            const float nx = frustum.nx[p], ny = frustum.ny[p], d = frustum.d[p];
+            const float far = nx * (nx >= 0.0f ? box.max_x : box.min_x) + ny * (ny >= 0.0f ? box.max_y : box.min_y) + d;
+            const float near = nx * (nx >= 0.0f ? box.min_x : box.max_x) + ny * (ny >= 0.0f ? box.min_y : box.max_y) + d;
+            if (far < 0.0f) {
+                return Overlap::outside;
+            }
+            if (near < 0.0f) {
+                overlap = Overlap::partial;
+            }
+        }
+        return overlap;
+#endif
+    }
 
-    uint32_t type_filter = mem_req.memoryTypeBits;
+    static Tree build_tree(const std::vector<Aabb> &bounds) {
+        Tree tree;
+        const uint32_t n = static_cast<uint32_t>(bounds.size());
+        if (n == 0) {
+            return tree;
+        }
+        tree.indices.resize(n);
+        std::vector<float> centres[2] = {std::vector<float>(n), std::vector<float>(n)};
+        for (uint32_t i = 0; i != n; ++i) {
+            tree.indices[i] = i;
+            centres[0][i] = 0.5f * (bounds[i].min_x + bounds[i].max_x);
+            centres[1][i] = 0.5f * (bounds[i].min_y + bounds[i].max_y);
+        }
+        // A binary tree whose leaves hold at least one object each can't
+        // have more nodes than this, so references into it stay good.
+        tree.nodes.reserve(2 * static_cast<std::size_t>(n) - 1);
+        tree.nodes.push_back({empty_box, 0, 0, n});
+        std::vector<uint32_t> stack{0};
+        while (!stack.empty()) {
+            Node &node = tree.nodes[stack.back()];
+            stack.pop_back();
+            const uint32_t first = node.first, count = node.count;
+            Aabb centroids = empty_box;
+            for (uint32_t k = first; k != first + count; ++k) {
+                const uint32_t i = tree.indices[k];
+                node.box = merge(node.box, bounds[i]);
+                const float cx = centres[0][i], cy = centres[1][i];
+                centroids = merge(centroids, {cx, cy, cx, cy});
+            }
+            if (count <= min_leaf_size) {
+                continue;
+            }
 
-    uint32_t type_idx = 0;
-    for (; type_idx != mem_props.memoryTypeCount; ++type_idx) {
-        if ((type_filter & (1u << type_idx)) &&
-            (mem_props.memoryTypes[type_idx].propertyFlags & properties) == properties) { 
-            break;
+            // Try splitting between each pair of bins along each axis, with
+            // the cost of each side its perimeter times how many objects it
+            // has.
+            float best_cost = std::numeric_limits<float>::max();
+            int best_axis = -1, best_split = 0;
+            const float lo[2] = {centroids.min_x, centroids.min_y};
+            const float extent[2] = {centroids.max_x - centroids.min_x, centroids.max_y - centroids.min_y};
+            const float scale[2] = {bin_count / extent[0], bin_count / extent[1]};
+            auto bin_of = [&](uint32_t i, int axis) {
+                return std::min(bin_count - 1, static_cast<int>((centres[axis][i] - lo[axis]) * scale[axis]));
+            };
+            for (int axis = 0; axis != 2; ++axis) {
+                if (extent[axis] <= 0.0f) {
+                    continue;
+                }
+                Aabb bin_boxes[bin_count];
+                uint32_t bin_counts[bin_count] = {};
+                std::fill(std::begin(bin_boxes), std::end(bin_boxes), empty_box);
+                for (uint32_t k = first; k != first + count; ++k) {
+                    const uint32_t i = tree.indices[k];
+                    const int b = bin_of(i, axis);
+                    bin_boxes[b] = merge(bin_boxes[b], bounds[i]);
+                    ++bin_counts[b];
+                }
+                // Everything right of each split, then sweep in from the left.
+                float right_cost[bin_count] = {};
+                Aabb box = empty_box;
+                uint32_t objects = 0;
+                for (int b = bin_count - 1; b > 0; --b) {
+                    box = merge(box, bin_boxes[b]);
+                    objects += bin_counts[b];
+                    right_cost[b] = objects ? half_perimeter(box) * objects : 0.0f;
+                }
+                box = empty_box;
+                objects = 0;
+                for (int b = 0; b != bin_count - 1; ++b) {
+                    box = merge(box, bin_boxes[b]);
+                    objects += bin_counts[b];
+                    const float cost = (objects ? half_perimeter(box) * objects : 0.0f) + right_cost[b + 1];
+                    if (objects != 0 && objects != count && cost < best_cost) {
+                        best_cost = cost;
+                        best_axis = axis;
+                        best_split = b + 1;
+                    }
+                }
+            }
+
+            // Splitting means visiting another node on top, not splitting
+            // testing everything in this one.
+            const float area = half_perimeter(node.box);
+            uint32_t left_count;
+            if (best_axis >= 0 && (area + best_cost < area * count || count > max_leaf_size)) {
+                const auto begin = tree.indices.begin() + first;
+                left_count = static_cast<uint32_t>(std::partition(begin, begin + count, [&](uint32_t i) {
+                    return bin_of(i, best_axis) < best_split;
+                }) - begin);
+            } else if (count > max_leaf_size) {
+                // Every centroid in one place, so any split is as good.
+                left_count = count / 2;
+            } else {
+                continue;
+            }
+            const uint32_t child = static_cast<uint32_t>(tree.nodes.size());
+            node.child = child;
+            tree.nodes.push_back({empty_box, 0, first, left_count});
+            tree.nodes.push_back({empty_box, 0, first + left_count, count - left_count});
+            stack.push_back(child);
+            stack.push_back(child + 1);
         }
+        tree.cost = tree_cost(tree);
+        return tree;
     }
-    if (type_idx >= mem_props.memoryTypeCount) {
-        std::cerr << "Failed to find a suitable memory type to allocate buffer\n";
-        return false;
+
+    void rebuild_loop() {
+        tracer.name_thread("BVH rebuild");
+        for (;;) {
+            std::vector<Aabb> bounds;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+                if (pending_.empty()) {
+                    return;
+                }
+                bounds = std::move(pending_);
+                pending_.clear();
+            }
+            TraceZone zone("BVH rebuild");
+            const auto begin = std::chrono::steady_clock::now();
+            Tree tree = build_tree(bounds);
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            std::lock_guard<std::mutex> lock(mutex_);
+            rebuilt_ = std::move(tree);
+            rebuild_seconds += seconds;
+            ++rebuilds;
+        }
     }
 
-    VkMemoryAllocateInfo alloc_info{
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .pNext = NULL,
-        .allocationSize = mem_req.size,
-        .memoryTypeIndex = type_idx,
+    Tree tree_;
+    float built_cost_ = 0.0f;
+    // Scratch for cull().
+    std::vector<uint8_t> flags_;
+    std::vector<uint32_t> stack_;
+
+    // Owned by the main thread.
+    bool rebuilding_ = false;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stopping_ = false;
+    // Bounds to rebuild from, and the result.
+    std::vector<Aabb> pending_;
+    std::optional<Tree> rebuilt_;
+};
+
+// Times scene updates at a range of sizes, scalar and SSE on one thread and
+// SSE across `threads`, writing into a buffer standing in for the mapped
+// object buffer. Then building, refitting and culling with a BVH over them.
+static void bench_transforms(std::size_t threads) {
+    ThreadPool pool(threads - 1, "Scene");
+    for (uint32_t n : {10000u, 100000u, 1000000u}) {
+        Scene scene;
+        build_grid_scene(scene, n, 1.0f);
+        scene.build(threads);
+        std::vector<uint8_t> out(static_cast<std::size_t>(n) * 32);
+        auto run = [&](const char *name, ThreadPool *p, bool simd) {
+            uint64_t updates = 0;
+            float time = 0.0f;
+            const auto start = std::chrono::steady_clock::now();
+            double seconds = 0.0;
+            while (seconds < 0.5 || updates < 3) {
+                scene.update(time += 1.0f / 60.0f, out.data(), 32, nullptr, p, simd);
+                ++updates;
+                seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            }
+            std::cout << "  " << std::setw(24) << std::left << name << std::right << std::setw(10) << updates / seconds << " updates/s, "
+                      << std::setw(8) << n * updates / seconds / 1e6 << " M objects/s\n";
+        };
+        std::cout << "Transforms: " << n << " objects\n";
+        run("scalar, 1 thread", nullptr, false);
+#ifdef SCENE_SSE2
+        run("SSE, 1 thread", nullptr, true);
+#endif
+        run((std::to_string(threads) + " threads").c_str(), &pool, true);
+
+        // And what the BVH costs at this size, with the rows swung part way
+        // off screen.
+        std::vector<Aabb> bounds(n);
+        std::vector<uint32_t> visible;
+        Bvh bvh;
+        auto time_ms = [](auto &&f) {
+            const auto begin = std::chrono::steady_clock::now();
+            f();
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        };
+        scene.update(0.5f, nullptr, 0, bounds.data(), &pool);
+        const double build_ms = time_ms([&] { bvh.build(bounds); });
+        scene.update(0.6f, nullptr, 0, bounds.data(), &pool);
+        const double refit_ms = time_ms([&] { bvh.refit(bounds); });
+        const double cull_ms = time_ms([&] { bvh.cull(Frustum::ndc(), bounds, visible); });
+        std::cout << "  BVH of " << bvh.nodes() << " nodes: build " << build_ms << " ms, refit " << refit_ms << " ms, cull "
+                  << cull_ms << " ms with " << 100.0 * (n - visible.size()) / n << "% culled\n";
+    }
+}
+
+// One level of detail of a mesh: a range of its index buffer, and roughly
+// how far, in mesh units, any of it can be from the full detail mesh.
+struct MeshLod {
+    uint32_t first_index;
+    uint32_t index_count;
+    float error;
+};
+
+// The quad as a grid of detail x detail cells with the corner colours
+// blended across it, so there's something for LODs to simplify. Vertices
+// are x, y, r, g, b, u, v; a detail of 1 is the plain quad.
+static void build_grid_mesh(uint32_t detail, std::vector<float> &vertices, std::vector<uint16_t> &indices) {
+    // Top left, top right, bottom left, bottom right.
+    const float corners[4][3] = {{1.0f, 1.0f, 1.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}};
+    vertices.clear();
+    indices.clear();
+    for (uint32_t y = 0; y <= detail; ++y) {
+        for (uint32_t x = 0; x <= detail; ++x) {
+            const float u = static_cast<float>(x) / detail, v = static_cast<float>(y) / detail;
+            vertices.insert(vertices.end(), {u - 0.5f, v - 0.5f});
+            for (int c = 0; c != 3; ++c) {
+                const float top = corners[0][c] + (corners[1][c] - corners[0][c]) * u;
+                const float bottom = corners[2][c] + (corners[3][c] - corners[2][c]) * u;
+                vertices.push_back(top + (bottom - top) * v);
+            }
+            vertices.insert(vertices.end(), {u, v});
+        }
+    }
+    for (uint32_t y = 0; y != detail; ++y) {
+        for (uint32_t x = 0; x != detail; ++x) {
+            const uint16_t a = static_cast<uint16_t>(y * (detail + 1) + x), b = a + 1;
+            const uint16_t c = static_cast<uint16_t>(b + detail + 1), d = c - 1;
+            indices.insert(indices.end(), {a, b, c, c, d, a});
+        }
+    }
+}
+
+// Works out a chain of simpler versions of the mesh in `indices` by vertex
+// clustering: snap the vertices to a grid, keep one per grid cell, and drop
+// triangles that collapse or flip. The cells double in size each level.
+// Each cell keeps whichever of its vertices matters most to the outline,
+// corners then other boundary vertices, else the one nearest its centre, so
+// the silhouette holds up. Every level uses the full detail vertices, so
+// the levels are just more indices, appended to `indices`. Returns the
+// ranges, full detail first.
+static std::vector<MeshLod> build_lods(const std::vector<float> &vertices, uint32_t floats_per_vertex, std::vector<uint16_t> &indices, std::size_t max_levels) {
+    const uint32_t base_count = static_cast<uint32_t>(indices.size());
+    std::vector<MeshLod> lods{{0, base_count, 0.0f}};
+    const std::size_t n_vertices = vertices.size() / floats_per_vertex;
+    if (base_count == 0) {
+        return lods;
+    }
+    auto x_of = [&](uint32_t v) {
+        return vertices[v * floats_per_vertex];
+    };
+    auto y_of = [&](uint32_t v) {
+        return vertices[v * floats_per_vertex + 1];
+    };
+    auto area = [&](uint32_t a, uint32_t b, uint32_t c) {
+        return (x_of(b) - x_of(a)) * (y_of(c) - y_of(a)) - (x_of(c) - x_of(a)) * (y_of(b) - y_of(a));
     };
 
-    if ((result = vkAllocateMemory(device, &alloc_info, nullptr, &mem)) != VK_SUCCESS) {
-        std::cerr << "Failed to allocate memory for buffer: " << string_VkResult(result) << "\n";
-        return false;
+    // Boundary edges belong to one triangle only. Where a vertex's two
+    // boundary edges don't line up, it's a corner.
+    std::vector<uint32_t> edges;
+    std::vector<uint8_t> used(n_vertices);
+    float edge_length = 0.0f, min_x = std::numeric_limits<float>::max(), min_y = min_x, max_x = std::numeric_limits<float>::lowest(), max_y = max_x;
+    for (uint32_t k = 0; k != base_count; ++k) {
+        const uint32_t a = indices[k], b = indices[k - k % 3 + (k + 1) % 3];
+        edges.push_back(std::min(a, b) << 16 | std::max(a, b));
+        edge_length += std::hypot(x_of(b) - x_of(a), y_of(b) - y_of(a));
+        used[a] = 1;
+        min_x = std::min(min_x, x_of(a)), max_x = std::max(max_x, x_of(a));
+        min_y = std::min(min_y, y_of(a)), max_y = std::max(max_y, y_of(a));
+    }
+    std::sort(edges.begin(), edges.end());
+    std::vector<uint32_t> boundary(n_vertices);
+    std::vector<float> dir_x(n_vertices), dir_y(n_vertices);
+    for (std::size_t k = 0; k != edges.size();) {
+        std::size_t end = k + 1;
+        while (end != edges.size() && edges[end] == edges[k]) {
+            ++end;
+        }
+        if (end == k + 1) {
+            const uint32_t a = edges[k] >> 16, b = edges[k] & 0xffff;
+            const float length = std::hypot(x_of(b) - x_of(a), y_of(b) - y_of(a));
+            if (length > 0.0f) {
+                const float dx = (x_of(b) - x_of(a)) / length, dy = (y_of(b) - y_of(a)) / length;
+                ++boundary[a], ++boundary[b];
+                dir_x[a] += dx, dir_y[a] += dy;
+                dir_x[b] -= dx, dir_y[b] -= dy;
+            }
+        }
+        k = end;
+    }
+    std::vector<uint8_t> weight(n_vertices);
+    for (std::size_t v = 0; v != n_vertices; ++v) {
+        if (boundary[v] != 0) {
+            weight[v] = boundary[v] != 2 || std::hypot(dir_x[v], dir_y[v]) > 0.1f ? 2 : 1;
+        }
     }
 
-    // For now we don't do bind offsets.
-    vkBindBufferMemory(device, b, mem, 0);
+    std::unordered_map<uint64_t, uint32_t> clusters;
+    std::vector<uint32_t> cluster_of(n_vertices), keep;
+    std::vector<uint64_t> triangles;
+    const float extent = std::max(max_x - min_x, max_y - min_y);
+    uint32_t previous = base_count / 3;
+    for (float cell = 2.0f * edge_length / base_count; lods.size() < max_levels && previous > 2 && cell < 2.0f * extent; cell *= 2.0f) {
+        clusters.clear();
+        keep.clear();
+        for (uint32_t v = 0; v != n_vertices; ++v) {
+            if (!used[v]) {
+                continue;
+            }
+            const float cx = std::floor((x_of(v) - min_x) / cell), cy = std::floor((y_of(v) - min_y) / cell);
+            const uint64_t key = static_cast<uint64_t>(static_cast<uint32_t>(cx)) << 32 | static_cast<uint32_t>(cy);
+            const auto [it, added] = clusters.try_emplace(key, static_cast<uint32_t>(keep.size()));
+            cluster_of[v] = it->second;
+            if (added) {
+                keep.push_back(v);
+                continue;
+            }
+            const uint32_t current = keep[it->second];
+            auto centre_distance = [&](uint32_t u) {
+                return std::hypot(x_of(u) - min_x - (cx + 0.5f) * cell, y_of(u) - min_y - (cy + 0.5f) * cell);
+            };
+            if (weight[v] > weight[current] || (weight[v] == weight[current] && centre_distance(v) < centre_distance(current))) {
+                keep[it->second] = v;
+            }
+        }
 
-    return true;
+        // Triangles that survive, each rotated to start at its smallest
+        // index so duplicates line up.
+        triangles.clear();
+        for (uint32_t k = 0; k != base_count; k += 3) {
+            uint64_t t[3];
+            for (int c = 0; c != 3; ++c) {
+                t[c] = keep[cluster_of[indices[k + c]]];
+            }
+            if (t[0] == t[1] || t[1] == t[2] || t[2] == t[0]) {
+                continue;
+            }
+            const float before = area(indices[k], indices[k + 1], indices[k + 2]);
+            const float after = area(static_cast<uint32_t>(t[0]), static_cast<uint32_t>(t[1]), static_cast<uint32_t>(t[2]));
+            if (after == 0.0f || (after > 0.0f) != (before > 0.0f)) {
+                continue;
+            }
+            const int first = t[0] < t[1] ? (t[0] < t[2] ? 0 : 2) : (t[1] < t[2] ? 1 : 2);
+            triangles.push_back(t[first] << 32 | t[(first + 1) % 3] << 16 | t[(first + 2) % 3]);
+        }
+        std::sort(triangles.begin(), triangles.end());
+        triangles.erase(std::unique(triangles.begin(), triangles.end()), triangles.end());
+        if (triangles.empty()) {
+            break;
+        }
+        // Not worth a level unless it saves a fair bit.
+        if (triangles.size() * 4 > previous * 3) {
+            continue;
+        }
+        const uint32_t first_index = static_cast<uint32_t>(indices.size());
+        for (const uint64_t t : triangles) {
+            indices.insert(indices.end(), {static_cast<uint16_t>(t >> 32), static_cast<uint16_t>(t >> 16), static_cast<uint16_t>(t)});
+        }
+        // Nothing moves further than across its cell.
+        lods.push_back({first_index, static_cast<uint32_t>(triangles.size() * 3), cell * std::sqrt(2.0f)});
+        previous = static_cast<uint32_t>(triangles.size());
+    }
+    return lods;
+}
+
+// Picks the level of detail for an object `pixels` across on screen: the
+// coarsest whose error stays under `max_error` pixels. To stop objects
+// flickering between levels right at a boundary, moving to a coarser level
+// than `current` needs it to be comfortably under, by lod_hysteresis.
+static constexpr float lod_hysteresis = 0.25f;
+static uint8_t select_lod(const std::vector<MeshLod> &lods, float pixels, uint8_t current, float max_error) {
+    uint8_t level = 0;
+    for (std::size_t i = lods.size(); i-- > 1;) {
+        if (lods[i].error * pixels <= max_error) {
+            level = static_cast<uint8_t>(i);
+            break;
+        }
+    }
+    while (level > current && lods[level].error * pixels > max_error * (1.0f - lod_hysteresis)) {
+        --level;
+    }
+    return level;
 }
 
+// A GPU particle, as the simulation's buffers hold it and as per-instance
+// vertex attributes read it.
+struct Particle {
+    float x, y;
+    float vx, vy;
+};
+
+// Push constants for the particle simulation.
+struct ParticleStep {
+    float dt;
+    float time;
+    uint32_t count;
+};
+
+// Push constants for bindless draws: which texture and buffer in the
+// descriptor table to use, and which object in that buffer.
+struct DrawConstants {
+    uint32_t texture;
+    uint32_t buffer;
+    uint32_t object;
+};
+
 int main(int argc, char** argv) {
+    const auto startup_begin = std::chrono::steady_clock::now();
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        return 1;
+    }
+    tracer.enabled = !options.trace_path.empty();
+    tracer.name_thread("Main");
+    logger.set_level(options.log_level);
+    logger.synchronous = options.log_sync;
+    logger.start();
+
+    // Every shader we might load, so they can all be packed.
+    const std::vector<std::string> shader_paths = {
+        "../shaders/vertex.spirv",
+        "../shaders/fragment.spirv",
+        "../shaders/vertex_bindless.spirv",
+        "../shaders/fragment_bindless.spirv",
+        "../shaders/fragment_overdraw.spirv",
+        "../shaders/compute_particles.spirv",
+        "../shaders/vertex_particles.spirv",
+        "../shaders/fragment_particles.spirv",
+    };
+    const std::size_t load_threads = options.load_threads ? options.load_threads : std::max(1u, std::thread::hardware_concurrency());
+    if (options.bench_transforms) {
+        bench_transforms(load_threads);
+        return 0;
+    }
+    if (!options.pack_path.empty()) {
+        std::vector<std::string> files = shader_paths;
+        files.insert(files.end(), options.texture_paths.begin(), options.texture_paths.end());
+        ThreadPool pool(load_threads, "Packer");
+        return AssetBundle::pack(options.pack_path, files, pool) ? 0 : 1;
+    }
+    // Opened up front so a bad bundle fails before we create anything. With
+    // no textures given we stream every KTX2 file in it.
+    std::optional<ThreadPool> load_pool;
+    AssetBundle bundle;
+    if (!options.bundle_path.empty()) {
+        load_pool.emplace(load_threads, "Asset loader");
+        if (!bundle.open(options.bundle_path, *load_pool)) {
+            return 1;
+        }
+        for (std::size_t i = 0; i != bundle.size() && options.texture_paths.empty(); ++i) {
+            const std::string &name = bundle.entry(i).name;
+            if (name.size() >= 5 && name.compare(name.size() - 5, 5, ".ktx2") == 0) {
+                options.texture_paths.push_back(name);
+            }
+        }
+    }
+    // Files come from the bundle if it has them, otherwise from disk.
+    auto load_asset = [&](const std::string &path) {
+        if (auto index = bundle.find(path)) {
+            return bundle.read_all(*index);
+        }
+        return read_bytes(path.c_str());
+    };
+
     // Initialise SDL subsystems - loading everything for
     // now though we don't need it.
     if (SDL_Init(SDL_INIT_EVERYTHING)) {
-        std::cerr << "Failed to initialize SDL subsystems\n";
+        log_error() << "Failed to initialize SDL subsystems";
         return 1;
     }
 
@@ -100,7 +4249,7 @@ int main(int argc, char** argv) {
                                    SDL_WINDOW_SHOWN |
                                    SDL_WINDOW_RESIZABLE |
                                    SDL_WINDOW_VULKAN)) == NULL) {
-        std::cerr << "Failed to create SDL window: " << SDL_GetError() << "\n";
+        log_error() << "Failed to create SDL window: " << SDL_GetError();
         return 1;
     }
 
@@ -111,7 +4260,17 @@ int main(int argc, char** argv) {
     appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     appInfo.pEngineName = "No engine";
     appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-    appInfo.apiVersion = VK_API_VERSION_1_0;
+    // Ask for 1.2 where the loader has it, for descriptor indexing, or 1.3
+    // for dynamic rendering. 1.0 loaders don't have vkEnumerateInstanceVersion
+    // at all.
+    uint32_t instance_version = VK_API_VERSION_1_0;
+    auto enumerate_instance_version = reinterpret_cast<PFN_vkEnumerateInstanceVersion>(
+        vkGetInstanceProcAddr(NULL, "vkEnumerateInstanceVersion"));
+    if (enumerate_instance_version) {
+        enumerate_instance_version(&instance_version);
+    }
+    appInfo.apiVersion = instance_version >= VK_API_VERSION_1_3 ? VK_API_VERSION_1_3 :
+        instance_version >= VK_API_VERSION_1_2 ? VK_API_VERSION_1_2 : VK_API_VERSION_1_0;
 
     VkInstanceCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -120,30 +4279,30 @@ int main(int argc, char** argv) {
     // Get the required Vulkan extensions to use it with SDL
     uint32_t sdl_ext_count = 0;
     if (SDL_Vulkan_GetInstanceExtensions(window, &sdl_ext_count, NULL) == SDL_FALSE) {
-        std::cerr << "Failed to count required vulkan extensions for SDL: " << SDL_GetError() << "\n";
+        log_error() << "Failed to count required vulkan extensions for SDL: " << SDL_GetError();
         return 1;
     }
 
-    std::cout << "There are " << sdl_ext_count << " required Vulkan extensions for SDL\n";
+    log_debug() << "There are " << sdl_ext_count << " required Vulkan extensions for SDL";
     char **sdl_ext_names = new char*[sdl_ext_count];
     if (SDL_Vulkan_GetInstanceExtensions(window, &sdl_ext_count, const_cast<const char **>(sdl_ext_names)) == SDL_FALSE) {
-        std::cerr << "Failed to get names of required vulkan extensions for SDL: " << SDL_GetError() << "\n";
+        log_error() << "Failed to get names of required vulkan extensions for SDL: " << SDL_GetError();
         return 1;
     }
     createInfo.enabledExtensionCount = sdl_ext_count;
     createInfo.ppEnabledExtensionNames = sdl_ext_names;
 
-    { // Dump available instance extensions 
+    if (logger.enabled(LogLevel::debug)) { // Dump available instance extensions
         uint32_t ext_count = 0;
         vkEnumerateInstanceExtensionProperties(nullptr, &ext_count, nullptr);
 
-        std::cout << "Found " << ext_count << " extensions:\n";
+        log_debug() << "Found " << ext_count << " extensions:";
 
         std::vector<VkExtensionProperties> exts(ext_count);
         vkEnumerateInstanceExtensionProperties(nullptr, &ext_count, exts.data());
 
         for (const auto &ext : exts) {
-            std::cout << "  " << ext.extensionName << "\n";
+            log_debug() << "  " << ext.extensionName;
         }
     }
 
@@ -172,7 +4331,7 @@ int main(int argc, char** argv) {
                     return std::strcmp(properties.layerName, layer_name) == 0;
                 });
                 if (it == layers.end()) {
-                    std::cerr << "Failed to find validation layer " << layer_name << std::endl;
+                    log_error() << "Failed to find validation layer " << layer_name;
                     return 1;
                 }
             }
@@ -183,17 +4342,26 @@ int main(int argc, char** argv) {
         }
     }
 
-    const VkAllocationCallbacks *apiAllocCallbacks = nullptr;
+    // Setup to handle N frames in flight
+    const int max_frames_in_flight = 2;
+
+    // Driver host allocations go through our own callbacks if asked, so we
+    // can see what they are. This has to outlive the instance.
+    std::optional<HostAllocator> host_allocator;
+    if (options.host_allocs) {
+        host_allocator.emplace(max_frames_in_flight, static_cast<std::size_t>(options.command_arena_kb * 1024));
+    }
+    const VkAllocationCallbacks *apiAllocCallbacks = host_allocator ? host_allocator->callbacks() : nullptr;
     VkResult result = VK_SUCCESS;
     if ((result = vkCreateInstance(&createInfo, apiAllocCallbacks, &instance)) != VK_SUCCESS) {
-        std::cerr << "Failed to create Vulkan instance: " << string_VkResult(result) << std::endl;
+        log_error() << "Failed to create Vulkan instance: " << string_VkResult(result);
         return 1;
     }
-    std::cout << "Created VkInstance" << std::endl;
+    log_info() << "Created VkInstance";
 
     VkSurfaceKHR surface;
     if (SDL_Vulkan_CreateSurface(window, instance, &surface) == SDL_FALSE) {
-        std::cerr << "Failed to create SDL window surface for Vulkan: " << SDL_GetError() << std::endl;
+        log_error() << "Failed to create SDL window surface for Vulkan: " << SDL_GetError();
         return 1;
     }
 
@@ -237,32 +4405,53 @@ int main(int argc, char** argv) {
     };
     
     VkPhysicalDevice physical_device = VK_NULL_HANDLE;
+    VkPhysicalDeviceProperties device_props;
     VkPhysicalDeviceMemoryProperties device_memory_props;
     int queue_graphics_family = 0, queue_present_family = 0;
+    // Where compute work goes, the graphics family unless there's a
+    // separate one we can use.
+    int queue_compute_family = 0;
+    // Number of valid bits in timestamps written on the graphics queue, 0 if
+    // timestamps aren't supported there. Likewise the compute queue.
+    uint32_t graphics_timestamp_bits = 0;
+    uint32_t compute_timestamp_bits = 0;
+    // What the device supports from 1.2, only queried if we need it.
+    VkPhysicalDeviceVulkan12Features vulkan12_features{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+        .pNext = NULL,
+    };
+    // Size of the bindless descriptor table, clamped to device limits.
+    uint32_t bindless_texture_slots = 1024;
+    uint32_t bindless_buffer_slots = 16;
+    // Whether we can read the GPU clock and steady_clock together with
+    // VK_EXT_calibrated_timestamps.
+    bool calibrated_timestamps = false;
+    // Whether dynamic rendering comes from VK_KHR_dynamic_rendering rather
+    // than core 1.3.
+    bool dynamic_rendering_extension = false;
     {
         uint32_t device_count = 0;
         vkEnumeratePhysicalDevices(instance, &device_count, NULL);
 
         if (device_count == 0) {
-            std::cerr << "Failed to find a VkPhysicalDevice to use" << std::endl;
+            log_error() << "Failed to find a VkPhysicalDevice to use";
             return 1;
         }
-        std::cout << "Found " << device_count << " potential VkPhysicalDevices to use" << std::endl;
+        log_info() << "Found " << device_count << " potential VkPhysicalDevices to use";
 
         std::vector<VkPhysicalDevice> devices(device_count);
         vkEnumeratePhysicalDevices(instance, &device_count, devices.data());
 
+        // We prefer a discrete GPU, but will settle for anything else that
+        // works, e.g. a software implementation when running headless tests.
+        VkPhysicalDevice fallback_device = VK_NULL_HANDLE;
         for (const auto &device : devices) {
-            std::cout << "Checking a physical device" << std::endl;
+            log_debug() << "Checking a physical device";
             VkPhysicalDeviceProperties props;
             VkPhysicalDeviceFeatures features;
             vkGetPhysicalDeviceProperties(device, &props);
             vkGetPhysicalDeviceFeatures(device, &features);
 
-            if (props.deviceType != VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
-                continue;
-            }
-
             uint32_t extension_count = 0;
             vkEnumerateDeviceExtensionProperties(device, NULL, &extension_count, NULL);
             std::vector<VkExtensionProperties> extensions(extension_count);
@@ -281,17 +4470,30 @@ int main(int argc, char** argv) {
                 continue;
             }
 
+            if (props.deviceType != VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
+                if (fallback_device == VK_NULL_HANDLE) {
+                    fallback_device = device;
+                }
+                continue;
+            }
+
             physical_device = device;
             break;
         }
 
         if (physical_device == VK_NULL_HANDLE) {
-            std::cerr << "Failed to find a suitable VkPhysicalDevice to use" << std::endl;
+            physical_device = fallback_device;
+        }
+        if (physical_device == VK_NULL_HANDLE) {
+            log_error() << "Failed to find a suitable VkPhysicalDevice to use";
             return 1;
         }
+        // Support info is left over from whichever device we checked last.
+        get_swap_chain_support(physical_device);
 
-        std::cout << "Found a VkPhysicalDevice" << std::endl;
+        log_info() << "Found a VkPhysicalDevice";
 
+        vkGetPhysicalDeviceProperties(physical_device, &device_props);
         vkGetPhysicalDeviceMemoryProperties(physical_device, &device_memory_props);
 
         uint32_t queue_family_count = 0;
@@ -314,16 +4516,140 @@ int main(int argc, char** argv) {
         }
 
         if (!graphics) {
-            std::cerr << "No queue family with graphics capability found" << std::endl;
+            log_error() << "No queue family with graphics capability found";
             return 1;
         }
         if (!present) {
-            std::cerr << "No queue family with present capability found" << std::endl;
+            log_error() << "No queue family with present capability found";
             return 1;
         }
         queue_graphics_family = *graphics;
         queue_present_family = *present;
-        std::cout << "Found queue graphics and present families" << std::endl;
+        graphics_timestamp_bits = queue_families[queue_graphics_family].timestampValidBits;
+        if (options.dynamic_resolution && graphics_timestamp_bits == 0) {
+            log_warning() << "Graphics queue doesn't support timestamps, disabling dynamic resolution";
+            options.dynamic_resolution = false;
+        }
+        log_info() << "Found queue graphics and present families";
+
+        // A compute-only family can usually run alongside graphics.
+        queue_compute_family = queue_graphics_family;
+        if (options.particles != 0 && options.async_compute) {
+            for (std::size_t idx = 0; idx != queue_family_count; ++idx) {
+                const VkQueueFlags flags = queue_families[idx].queueFlags;
+                if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+                    queue_compute_family = static_cast<int>(idx);
+                    break;
+                }
+            }
+            if (queue_compute_family == queue_graphics_family) {
+                log_warning() << "No separate compute queue family, simulating particles on the graphics queue";
+            }
+        }
+        compute_timestamp_bits = queue_families[queue_compute_family].timestampValidBits;
+
+        const bool vulkan12 = appInfo.apiVersion >= VK_API_VERSION_1_2 && device_props.apiVersion >= VK_API_VERSION_1_2;
+        VkPhysicalDeviceFeatures2 features2{
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &vulkan12_features,
+        };
+        if (vulkan12) {
+            vkGetPhysicalDeviceFeatures2(physical_device, &features2);
+        }
+
+        if (options.bindless) {
+            const bool supported = vulkan12 &&
+                features2.features.shaderSampledImageArrayDynamicIndexing &&
+                features2.features.shaderStorageBufferArrayDynamicIndexing &&
+                vulkan12_features.runtimeDescriptorArray &&
+                vulkan12_features.descriptorBindingPartiallyBound &&
+                vulkan12_features.descriptorBindingSampledImageUpdateAfterBind &&
+                vulkan12_features.descriptorBindingStorageBufferUpdateAfterBind;
+            if (supported) {
+                VkPhysicalDeviceVulkan12Properties vulkan12_props{
+                    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES,
+                    .pNext = NULL,
+                };
+                VkPhysicalDeviceProperties2 props2{
+                    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+                    .pNext = &vulkan12_props,
+                };
+                vkGetPhysicalDeviceProperties2(physical_device, &props2);
+                bindless_texture_slots = std::min({bindless_texture_slots,
+                    vulkan12_props.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                    vulkan12_props.maxDescriptorSetUpdateAfterBindSampledImages});
+                bindless_buffer_slots = std::min({bindless_buffer_slots,
+                    vulkan12_props.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+                    vulkan12_props.maxDescriptorSetUpdateAfterBindStorageBuffers});
+            } else {
+                log_warning() << "Device doesn't support Vulkan 1.2 descriptor indexing, disabling bindless";
+                options.bindless = false;
+            }
+        }
+        if (options.timeline_semaphores && !(vulkan12 && vulkan12_features.timelineSemaphore)) {
+            log_warning() << "Device doesn't support Vulkan 1.2 timeline semaphores, using fences";
+            options.timeline_semaphores = false;
+        }
+        VkPhysicalDeviceFeatures supported_features;
+        vkGetPhysicalDeviceFeatures(physical_device, &supported_features);
+        if (options.pipeline_stats && !supported_features.pipelineStatisticsQuery) {
+            log_warning() << "Device doesn't support pipeline statistics queries, disabling them";
+            options.pipeline_stats = false;
+        }
+
+        // steady_clock is CLOCK_MONOTONIC on Linux, so that's the domain we
+        // need alongside the device's.
+        uint32_t extension_count = 0;
+        vkEnumerateDeviceExtensionProperties(physical_device, NULL, &extension_count, NULL);
+        std::vector<VkExtensionProperties> extensions(extension_count);
+        vkEnumerateDeviceExtensionProperties(physical_device, NULL, &extension_count, extensions.data());
+        auto get_time_domains = reinterpret_cast<PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT>(
+            vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT"));
+        const bool has_extension = std::any_of(extensions.begin(), extensions.end(), [](const VkExtensionProperties &extension) {
+            return std::strcmp(extension.extensionName, VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME) == 0;
+        });
+        if (graphics_timestamp_bits != 0 && has_extension && get_time_domains) {
+            uint32_t domain_count = 0;
+            get_time_domains(physical_device, &domain_count, NULL);
+            std::vector<VkTimeDomainEXT> domains(domain_count);
+            get_time_domains(physical_device, &domain_count, domains.data());
+            calibrated_timestamps =
+                std::find(domains.begin(), domains.end(), VK_TIME_DOMAIN_DEVICE_EXT) != domains.end() &&
+                std::find(domains.begin(), domains.end(), VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT) != domains.end();
+        }
+
+        // Dynamic rendering is core in 1.3. On 1.2 we can use the extension,
+        // which builds on render pass 2 and depth/stencil resolve from 1.2.
+        if (options.dynamic_rendering) {
+            const bool vulkan13 = appInfo.apiVersion >= VK_API_VERSION_1_3 && device_props.apiVersion >= VK_API_VERSION_1_3;
+            const bool has_dynamic_rendering = vulkan12 && std::any_of(extensions.begin(), extensions.end(), [](const VkExtensionProperties &extension) {
+                return std::strcmp(extension.extensionName, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME) == 0;
+            });
+            VkPhysicalDeviceVulkan13Features vulkan13_features{
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+                .pNext = NULL,
+            };
+            VkPhysicalDeviceDynamicRenderingFeatures dynamic_rendering_features{
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES,
+                .pNext = NULL,
+                .dynamicRendering = VK_FALSE,
+            };
+            VkPhysicalDeviceFeatures2 dynamic_features2{
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+                .pNext = vulkan13 ? static_cast<void *>(&vulkan13_features) : static_cast<void *>(&dynamic_rendering_features),
+            };
+            if (vulkan13 || has_dynamic_rendering) {
+                vkGetPhysicalDeviceFeatures2(physical_device, &dynamic_features2);
+            }
+            if (vulkan13 && vulkan13_features.dynamicRendering) {
+                dynamic_rendering_extension = false;
+            } else if (!vulkan13 && has_dynamic_rendering && dynamic_rendering_features.dynamicRendering) {
+                dynamic_rendering_extension = true;
+            } else {
+                log_warning() << "Device doesn't support dynamic rendering, using render passes";
+                options.dynamic_rendering = false;
+            }
+        }
     }
 
     // Create logical device
@@ -331,12 +4657,12 @@ int main(int argc, char** argv) {
     {
         std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
 
-        std::set<int> unique_queue_families = {queue_graphics_family, queue_present_family};
+        std::set<int> unique_queue_families = {queue_graphics_family, queue_present_family, queue_compute_family};
         float queue_priority = 1.0f;
         for (const auto &family : unique_queue_families) {
             VkDeviceQueueCreateInfo queue_create_info{};
             queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-            queue_create_info.queueFamilyIndex = queue_graphics_family;
+            queue_create_info.queueFamilyIndex = static_cast<uint32_t>(family);
             queue_create_info.queueCount = 1;
             queue_create_info.pQueuePriorities = &queue_priority;
             queue_create_infos.emplace_back(std::move(queue_create_info));
@@ -350,8 +4676,48 @@ int main(int argc, char** argv) {
         create_info.queueCreateInfoCount = static_cast<uint32_t>(queue_create_infos.size());
         create_info.pEnabledFeatures = &device_features;
 
-        create_info.ppEnabledExtensionNames = device_extensions.data();
-        create_info.enabledExtensionCount = static_cast<uint32_t>(device_extensions.size());
+        VkPhysicalDeviceVulkan12Features enabled_vulkan12_features{
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+            .pNext = NULL,
+        };
+        if (options.bindless) {
+            enabled_vulkan12_features.runtimeDescriptorArray = VK_TRUE;
+            enabled_vulkan12_features.descriptorBindingPartiallyBound = VK_TRUE;
+            enabled_vulkan12_features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+            enabled_vulkan12_features.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+        }
+        if (options.timeline_semaphores) {
+            enabled_vulkan12_features.timelineSemaphore = VK_TRUE;
+        }
+        if (options.bindless || options.timeline_semaphores) {
+            create_info.pNext = &enabled_vulkan12_features;
+        }
+
+        std::vector<const char *> enabled_extensions = device_extensions;
+        if (calibrated_timestamps) {
+            enabled_extensions.push_back(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+        }
+        // Either feature struct goes on the front of the chain.
+        VkPhysicalDeviceVulkan13Features enabled_vulkan13_features{
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+            .pNext = NULL,
+        };
+        VkPhysicalDeviceDynamicRenderingFeatures enabled_dynamic_rendering_features{
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES,
+            .pNext = NULL,
+            .dynamicRendering = VK_TRUE,
+        };
+        if (options.dynamic_rendering && dynamic_rendering_extension) {
+            enabled_extensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+            enabled_dynamic_rendering_features.pNext = const_cast<void *>(create_info.pNext);
+            create_info.pNext = &enabled_dynamic_rendering_features;
+        } else if (options.dynamic_rendering) {
+            enabled_vulkan13_features.dynamicRendering = VK_TRUE;
+            enabled_vulkan13_features.pNext = const_cast<void *>(create_info.pNext);
+            create_info.pNext = &enabled_vulkan13_features;
+        }
+        create_info.ppEnabledExtensionNames = enabled_extensions.data();
+        create_info.enabledExtensionCount = static_cast<uint32_t>(enabled_extensions.size());
 
         if (enable_validation_layers) {
             create_info.enabledLayerCount = static_cast<uint32_t>(validation_layers.size());
@@ -361,25 +4727,49 @@ int main(int argc, char** argv) {
         }
         
         if ((result = vkCreateDevice(physical_device, &create_info, apiAllocCallbacks, &device)) != VK_SUCCESS) {
-            std::cerr << "Failed to create logical device: " << string_VkResult(result) << std::endl;
+            log_error() << "Failed to create logical device: " << string_VkResult(result);
             return 1;
         }
-        std::cout << "Created logical device" << std::endl;
+        log_info() << "Created logical device";
     }
 
     // Get our graphics queue.
-    VkQueue graphics_queue, present_queue;
+    VkQueue graphics_queue, present_queue, compute_queue;
     // NOTE: These queues may well be the same, but these are just handles
     // to them. When creating the logical device we ensured we used unique 
     // queue indices.
     vkGetDeviceQueue(device, queue_graphics_family, 0, &graphics_queue);
     vkGetDeviceQueue(device, queue_present_family, 0, &present_queue);
+    vkGetDeviceQueue(device, queue_compute_family, 0, &compute_queue);
+    const bool async_compute = queue_compute_family != queue_graphics_family;
+    if (options.particles != 0) {
+        log_info() << "Simulating particles on the " << (async_compute ? "async compute" : "graphics") << " queue";
+    }
+
+    // The extension's entry points have a KHR suffix, and the loader we link
+    // against may predate 1.3, so look them up either way.
+    PFN_vkCmdBeginRenderingKHR cmd_begin_rendering = nullptr;
+    PFN_vkCmdEndRenderingKHR cmd_end_rendering = nullptr;
+    if (options.dynamic_rendering) {
+        cmd_begin_rendering = reinterpret_cast<PFN_vkCmdBeginRenderingKHR>(
+            vkGetDeviceProcAddr(device, dynamic_rendering_extension ? "vkCmdBeginRenderingKHR" : "vkCmdBeginRendering"));
+        cmd_end_rendering = reinterpret_cast<PFN_vkCmdEndRenderingKHR>(
+            vkGetDeviceProcAddr(device, dynamic_rendering_extension ? "vkCmdEndRenderingKHR" : "vkCmdEndRendering"));
+        if (!cmd_begin_rendering || !cmd_end_rendering) {
+            log_error() << "Failed to get dynamic rendering entry points";
+            return 1;
+        }
+        log_info() << "Using dynamic rendering" << (dynamic_rendering_extension ? " from VK_KHR_dynamic_rendering" : "");
+    }
 
     // Load shader SPIR-V
     VkShaderModule vert_module = VK_NULL_HANDLE, frag_module = VK_NULL_HANDLE;
+    VkShaderModule overdraw_frag_module = VK_NULL_HANDLE;
+    VkShaderModule particle_compute_module = VK_NULL_HANDLE;
+    VkShaderModule particle_vert_module = VK_NULL_HANDLE, particle_frag_module = VK_NULL_HANDLE;
     {
-        auto vert_bytes = read_bytes("../shaders/vertex.spirv");
-        auto frag_bytes = read_bytes("../shaders/fragment.spirv");
+        auto vert_bytes = load_asset(options.bindless ? "../shaders/vertex_bindless.spirv" : "../shaders/vertex.spirv");
+        auto frag_bytes = load_asset(options.bindless ? "../shaders/fragment_bindless.spirv" : "../shaders/fragment.spirv");
 
         VkShaderModuleCreateInfo create_info{};
         create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
@@ -387,23 +4777,66 @@ int main(int argc, char** argv) {
         create_info.pCode = reinterpret_cast<const uint32_t *>(vert_bytes.data());
 
         if ((result = vkCreateShaderModule(device, &create_info, apiAllocCallbacks, &vert_module)) != VK_SUCCESS) {
-            std::cerr << "Failed to create shader module for vertex shader: " << string_VkResult(result) << "\n";
+            log_error() << "Failed to create shader module for vertex shader: " << string_VkResult(result);
             return 1;
         }
 
         create_info.codeSize = frag_bytes.size();
         create_info.pCode = reinterpret_cast<const uint32_t *>(frag_bytes.data());
         if ((result = vkCreateShaderModule(device, &create_info, apiAllocCallbacks, &frag_module)) != VK_SUCCESS) {
-            std::cerr << "Failed to create shader module for fragment shader: " << string_VkResult(result) << "\n";
+            log_error() << "Failed to create shader module for fragment shader: " << string_VkResult(result);
             return 1;
         }
+
+        if (options.overdraw) {
+            auto overdraw_bytes = load_asset("../shaders/fragment_overdraw.spirv");
+            create_info.codeSize = overdraw_bytes.size();
+            create_info.pCode = reinterpret_cast<const uint32_t *>(overdraw_bytes.data());
+            if ((result = vkCreateShaderModule(device, &create_info, apiAllocCallbacks, &overdraw_frag_module)) != VK_SUCCESS) {
+                log_error() << "Failed to create shader module for overdraw fragment shader: " << string_VkResult(result);
+                return 1;
+            }
+        }
+
+        if (options.particles != 0) {
+            const std::pair<const char *, VkShaderModule *> particle_shaders[] = {
+                {"../shaders/compute_particles.spirv", &particle_compute_module},
+                {"../shaders/vertex_particles.spirv", &particle_vert_module},
+                {"../shaders/fragment_particles.spirv", &particle_frag_module},
+            };
+            for (const auto &[path, module] : particle_shaders) {
+                auto bytes = load_asset(path);
+                create_info.codeSize = bytes.size();
+                create_info.pCode = reinterpret_cast<const uint32_t *>(bytes.data());
+                if ((result = vkCreateShaderModule(device, &create_info, apiAllocCallbacks, module)) != VK_SUCCESS) {
+                    log_error() << "Failed to create shader module for " << path << ": " << string_VkResult(result);
+                    return 1;
+                }
+            }
+        }
     }
 
     VkSurfaceFormatKHR selected_format = swap_chain_support.formats.front();
 
-    VkRenderPass render_pass;
+    // The render passes are all left null with dynamic rendering.
+    VkRenderPass render_pass = VK_NULL_HANDLE;
+    // Same as render_pass except it leaves the colour attachment ready to be
+    // blitted from, for rendering into the scaled offscreen targets. The
+    // two are compatible so graphics_pipeline can be used with either.
+    VkRenderPass scaled_render_pass = VK_NULL_HANDLE;
+    VkFormat scene_format;
+    VkDescriptorSetLayout set_layout;
     VkPipelineLayout pipeline_layout;
     VkPipeline graphics_pipeline;
+    // Overdraw counting: the same draws with a fragment shader that just
+    // outputs 1, added up in a half float target.
+    const VkFormat overdraw_format = VK_FORMAT_R16_SFLOAT;
+    VkRenderPass overdraw_render_pass = VK_NULL_HANDLE;
+    VkPipeline overdraw_pipeline = VK_NULL_HANDLE;
+    // Point sprites for the particles, which take their size in push
+    // constants and nothing else.
+    VkPipelineLayout particle_layout = VK_NULL_HANDLE;
+    VkPipeline particle_pipeline = VK_NULL_HANDLE;
     { // Create pipeline
         VkPipelineShaderStageCreateInfo vert_create_info{};
         vert_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -438,8 +4871,8 @@ int main(int argc, char** argv) {
         // Create description of our vertex buffer binding
         VkVertexInputBindingDescription input_binding{
             .binding = 0,
-            // 5 32-bit floats, 2 for pos, 3 for colour
-            .stride = 5 * 4,
+            // 7 32-bit floats, 2 for pos, 3 for colour, 2 for texture coords
+            .stride = 7 * 4,
             // This relates to instancing.
             .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
         };
@@ -463,6 +4896,13 @@ int main(int argc, char** argv) {
                 .format = VK_FORMAT_R32G32B32_SFLOAT,
                 // Offset is 2 32-bit floats or (2 * 4) = 8 bytes
                 .offset = 2 * 4,
+            },
+            // Texture coordinates
+            {
+                .location = 2,
+                .binding = 0,
+                .format = VK_FORMAT_R32G32_SFLOAT,
+                .offset = 5 * 4,
             }
         };
 
@@ -471,7 +4911,7 @@ int main(int argc, char** argv) {
             .pNext = NULL,
             .vertexBindingDescriptionCount = 1,
             .pVertexBindingDescriptions = &input_binding,
-            .vertexAttributeDescriptionCount = 2,
+            .vertexAttributeDescriptionCount = 3,
             .pVertexAttributeDescriptions = input_attrs,
         };
 
@@ -528,10 +4968,82 @@ int main(int argc, char** argv) {
         color_blend_state.attachmentCount = 1;
         color_blend_state.pAttachments = &color_blend_attachment;
 
+        // Classic: a combined image sampler for the fragment shader's texture,
+        // and the object's transform at a dynamic offset in a uniform buffer,
+        // so each draw binds a set.
+        //
+        // Bindless: arrays of every texture and buffer, picked from with
+        // indices in push constants, so the set is bound once per frame. The
+        // arrays are update-after-bind and partially bound, so slots can be
+        // filled in as textures arrive without rebinding or rebuilding
+        // anything, and unused slots can be left empty.
+        std::vector<VkDescriptorSetLayoutBinding> bindings;
+        std::vector<VkDescriptorBindingFlags> binding_flags;
+        if (options.bindless) {
+            bindings.push_back({
+                .binding = 0,
+                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                .descriptorCount = bindless_texture_slots,
+                .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+                .pImmutableSamplers = NULL,
+            });
+            bindings.push_back({
+                .binding = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .descriptorCount = bindless_buffer_slots,
+                .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+                .pImmutableSamplers = NULL,
+            });
+            binding_flags.assign(2, VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT);
+        } else {
+            bindings.push_back({
+                .binding = 0,
+                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                .descriptorCount = 1,
+                .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+                .pImmutableSamplers = NULL,
+            });
+            bindings.push_back({
+                .binding = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                .descriptorCount = 1,
+                .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+                .pImmutableSamplers = NULL,
+            });
+        }
+        VkDescriptorSetLayoutBindingFlagsCreateInfo binding_flags_info{
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+            .pNext = NULL,
+            .bindingCount = static_cast<uint32_t>(binding_flags.size()),
+            .pBindingFlags = binding_flags.data(),
+        };
+        VkDescriptorSetLayoutCreateInfo set_layout_info{
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+            .pNext = options.bindless ? &binding_flags_info : NULL,
+            .flags = options.bindless ? static_cast<VkDescriptorSetLayoutCreateFlags>(VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT) : 0u,
+            .bindingCount = static_cast<uint32_t>(bindings.size()),
+            .pBindings = bindings.data(),
+        };
+        if ((result = vkCreateDescriptorSetLayout(device, &set_layout_info, apiAllocCallbacks, &set_layout)) != VK_SUCCESS) {
+            log_error() << "Failed to create descriptor set layout: " << string_VkResult(result);
+            return 1;
+        }
+
+        VkPushConstantRange push_constants{
+            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+            .offset = 0,
+            .size = sizeof(DrawConstants),
+        };
         VkPipelineLayoutCreateInfo pipeline_layout_info{};
         pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipeline_layout_info.setLayoutCount = 1;
+        pipeline_layout_info.pSetLayouts = &set_layout;
+        if (options.bindless) {
+            pipeline_layout_info.pushConstantRangeCount = 1;
+            pipeline_layout_info.pPushConstantRanges = &push_constants;
+        }
         if ((result = vkCreatePipelineLayout(device, &pipeline_layout_info, apiAllocCallbacks, &pipeline_layout)) != VK_SUCCESS) {
-            std::cerr << "Failed to create pipeline layout: " << string_VkResult(result) << "\n";
+            log_error() << "Failed to create pipeline layout: " << string_VkResult(result);
             return 1;
         }
 
@@ -582,13 +5094,68 @@ int main(int argc, char** argv) {
             .pDependencies = &dependency,
         };
 
-        if ((result = vkCreateRenderPass(device, &render_pass_info, apiAllocCallbacks, &render_pass)) != VK_SUCCESS) {
-            std::cerr << "Failed to create render pass: " << string_VkResult(result) << "\n";
-            return 1;
+        scene_format = color_attachment.format;
+        // With dynamic rendering, pipelines just need to know the attachment
+        // formats they'll be used with.
+        VkPipelineRenderingCreateInfo pipeline_rendering_info{
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
+            .pNext = NULL,
+            .viewMask = 0,
+            .colorAttachmentCount = 1,
+            .pColorAttachmentFormats = &scene_format,
+            .depthAttachmentFormat = VK_FORMAT_UNDEFINED,
+            .stencilAttachmentFormat = VK_FORMAT_UNDEFINED,
+        };
+
+        if (!options.dynamic_rendering) {
+            if ((result = vkCreateRenderPass(device, &render_pass_info, apiAllocCallbacks, &render_pass)) != VK_SUCCESS) {
+                log_error() << "Failed to create render pass: " << string_VkResult(result);
+                return 1;
+            }
+
+            // Offscreen targets are read by a transfer once the pass is done.
+            // The previous frame to use a target read from it, so don't start
+            // writing until that transfer is done, and make what the pass
+            // writes visible to the transfer after it.
+            VkSubpassDependency offscreen_dependencies[] = {
+                dependency,
+                {
+                    .srcSubpass = 0,
+                    .dstSubpass = VK_SUBPASS_EXTERNAL,
+                    .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                    .dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                    .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+                },
+            };
+            offscreen_dependencies[0].srcStageMask |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+            if (options.dynamic_resolution) {
+                color_attachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+                render_pass_info.dependencyCount = 2;
+                render_pass_info.pDependencies = offscreen_dependencies;
+                if ((result = vkCreateRenderPass(device, &render_pass_info, apiAllocCallbacks, &scaled_render_pass)) != VK_SUCCESS) {
+                    log_error() << "Failed to create scaled render pass: " << string_VkResult(result);
+                    return 1;
+                }
+            }
+
+            if (options.overdraw) {
+                // Cleared to zero, and copied out for counting afterwards.
+                color_attachment.format = overdraw_format;
+                color_attachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+                render_pass_info.dependencyCount = 2;
+                render_pass_info.pDependencies = offscreen_dependencies;
+                if ((result = vkCreateRenderPass(device, &render_pass_info, apiAllocCallbacks, &overdraw_render_pass)) != VK_SUCCESS) {
+                    log_error() << "Failed to create overdraw render pass: " << string_VkResult(result);
+                    return 1;
+                }
+            }
         }
 
         VkGraphicsPipelineCreateInfo pipeline_info{
             .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+            .pNext = options.dynamic_rendering ? &pipeline_rendering_info : NULL,
             .stageCount = 2,
             .pStages = stages,
             .pVertexInputState = &vertex_input,
@@ -606,20 +5173,149 @@ int main(int argc, char** argv) {
             .basePipelineIndex = -1
         };
 
-        if ((result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipeline_info, NULL, &graphics_pipeline)) != VK_SUCCESS) {
-            std::cerr << "Failed to create graphics pipeline: " << string_VkResult(result) << "\n";
+        if ((result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipeline_info, apiAllocCallbacks, &graphics_pipeline)) != VK_SUCCESS) {
+            log_error() << "Failed to create graphics pipeline: " << string_VkResult(result);
             return 1;
         }
+
+        if (options.particles != 0) {
+            VkPushConstantRange sprite_constants{
+                .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+                .offset = 0,
+                .size = 2 * sizeof(float),
+            };
+            VkPipelineLayoutCreateInfo particle_layout_info{
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+                .pNext = NULL,
+                .flags = 0,
+                .setLayoutCount = 0,
+                .pSetLayouts = NULL,
+                .pushConstantRangeCount = 1,
+                .pPushConstantRanges = &sprite_constants,
+            };
+            if ((result = vkCreatePipelineLayout(device, &particle_layout_info, apiAllocCallbacks, &particle_layout)) != VK_SUCCESS) {
+                log_error() << "Failed to create particle pipeline layout: " << string_VkResult(result);
+                return 1;
+            }
+
+            // Each instance is a particle, read straight out of the
+            // simulation's buffer, and its corners come from the vertex
+            // index.
+            VkVertexInputBindingDescription particle_binding{
+                .binding = 0,
+                .stride = sizeof(Particle),
+                .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE,
+            };
+            VkVertexInputAttributeDescription particle_attrs[] = {
+                {.location = 0, .binding = 0, .format = VK_FORMAT_R32G32_SFLOAT, .offset = offsetof(Particle, x)},
+                {.location = 1, .binding = 0, .format = VK_FORMAT_R32G32_SFLOAT, .offset = offsetof(Particle, vx)},
+            };
+            VkPipelineVertexInputStateCreateInfo particle_input{
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+                .pNext = NULL,
+                .vertexBindingDescriptionCount = 1,
+                .pVertexBindingDescriptions = &particle_binding,
+                .vertexAttributeDescriptionCount = 2,
+                .pVertexAttributeDescriptions = particle_attrs,
+            };
+            VkPipelineShaderStageCreateInfo particle_stages[] = {vert_create_info, frag_create_info};
+            particle_stages[0].module = particle_vert_module;
+            particle_stages[1].module = particle_frag_module;
+            VkPipelineRasterizationStateCreateInfo particle_rasterization = rasterization;
+            particle_rasterization.cullMode = VK_CULL_MODE_NONE;
+            // Added on top of whatever's there.
+            VkPipelineColorBlendAttachmentState particle_blend_attachment = color_blend_attachment;
+            particle_blend_attachment.blendEnable = VK_TRUE;
+            particle_blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+            particle_blend_attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+            particle_blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
+            particle_blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+            particle_blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+            particle_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
+            VkPipelineColorBlendStateCreateInfo particle_blend_state = color_blend_state;
+            particle_blend_state.pAttachments = &particle_blend_attachment;
+
+            VkGraphicsPipelineCreateInfo particle_info = pipeline_info;
+            particle_info.pStages = particle_stages;
+            particle_info.pVertexInputState = &particle_input;
+            particle_info.pRasterizationState = &particle_rasterization;
+            particle_info.pColorBlendState = &particle_blend_state;
+            particle_info.layout = particle_layout;
+            if ((result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &particle_info, apiAllocCallbacks, &particle_pipeline)) != VK_SUCCESS) {
+                log_error() << "Failed to create particle pipeline: " << string_VkResult(result);
+                return 1;
+            }
+        }
+
+        if (options.overdraw) {
+            stages[1].module = overdraw_frag_module;
+            color_blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT;
+            color_blend_attachment.blendEnable = VK_TRUE;
+            color_blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+            color_blend_attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+            color_blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
+            color_blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+            color_blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+            color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
+            pipeline_info.renderPass = overdraw_render_pass;
+            pipeline_rendering_info.pColorAttachmentFormats = &overdraw_format;
+            if ((result = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipeline_info, apiAllocCallbacks, &overdraw_pipeline)) != VK_SUCCESS) {
+                log_error() << "Failed to create overdraw pipeline: " << string_VkResult(result);
+                return 1;
+            }
+        }
     }
 
     VkSwapchainKHR swap_chain = VK_NULL_HANDLE;
+    std::vector<VkImage> swap_images;
     std::vector<VkImageView> swap_image_views;
     std::vector<VkFramebuffer> swap_framebuffers;
     VkExtent2D swap_chain_extent;
+
+    // Offscreen targets for dynamic resolution, one per frame in flight so
+    // one frame can be blitting from its target while the next renders.
+    // They're allocated at the full swap chain size and we render into the
+    // top-left corner, so changing scale never means reallocating.
+    struct ScaledTarget {
+        VkImage image;
+        VkDeviceMemory memory;
+        VkImageView view;
+        VkFramebuffer framebuffer;
+    };
+    std::vector<ScaledTarget> scaled_targets;
+    VkFilter blit_filter = VK_FILTER_LINEAR;
+
+    // Overdraw targets, also per frame in flight and full size, each with a
+    // buffer its counts are copied to for us to add up once the frame's done.
+    struct OverdrawTarget {
+        ScaledTarget target;
+        VkBuffer readback;
+        VkDeviceMemory readback_memory;
+        const uint16_t *counts;
+        // Size of the region rendered to, if the frame drew anything.
+        std::optional<VkExtent2D> extent;
+    };
+    std::vector<OverdrawTarget> overdraw_targets;
+    // Bumped every time the swap chain is (re)created, so anything recorded
+    // against the old one knows it's stale.
+    uint64_t swap_chain_generation = 0;
+
+    // Frame capture. The writer is started up front so a bad path fails
+    // before we bother creating everything else.
+    bool capturing = !options.capture_path.empty() || !options.compare_path.empty();
+    bool capture_bgra = false;
+    FrameWriter frame_writer;
+    if (capturing && !frame_writer.start(options.capture_path, !options.compare_path.empty())) {
+        return 1;
+    }
+    if (capturing && (!options.perf_baseline_path.empty() || !options.write_perf_baseline_path.empty())) {
+        log_warning() << "Frame times include reading back every frame for capture, check performance in a run without it";
+    }
+
     auto create_swap_chain = [&]{
         // Refresh swap chain support info
         if (!get_swap_chain_support(physical_device)) {
-            std::cerr << "Failed to get swap chain support info\n";
+            log_error() << "Failed to get swap chain support info";
             return 1;
         }
 
@@ -631,6 +5327,39 @@ int main(int argc, char** argv) {
             }
         }
 
+        if (options.dynamic_resolution) {
+            VkFormatProperties src_props, dst_props;
+            vkGetPhysicalDeviceFormatProperties(physical_device, scene_format, &src_props);
+            vkGetPhysicalDeviceFormatProperties(physical_device, selected_format.format, &dst_props);
+            if (!(swap_chain_support.caps.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT) ||
+                !(src_props.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT) ||
+                !(dst_props.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT)) {
+                log_warning() << "Swap chain can't be blitted to, disabling dynamic resolution";
+                options.dynamic_resolution = false;
+            }
+            blit_filter = (src_props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+        }
+
+        if (capturing) {
+            switch (selected_format.format) {
+            case VK_FORMAT_B8G8R8A8_UNORM:
+            case VK_FORMAT_B8G8R8A8_SRGB:
+                capture_bgra = true;
+                break;
+            case VK_FORMAT_R8G8B8A8_UNORM:
+            case VK_FORMAT_R8G8B8A8_SRGB:
+                capture_bgra = false;
+                break;
+            default:
+                log_warning() << "Can't capture swap chain format " << string_VkFormat(selected_format.format) << ", disabling capture";
+                capturing = false;
+            }
+            if (!(swap_chain_support.caps.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT)) {
+                log_warning() << "Swap chain can't be copied from, disabling capture";
+                capturing = false;
+            }
+        }
+
         VkPresentModeKHR selected_present_mode = swap_chain_support.modes.front();
         for (const auto &present_mode : swap_chain_support.modes) {
             if (present_mode == VK_PRESENT_MODE_MAILBOX_KHR) {
@@ -672,6 +5401,12 @@ int main(int argc, char** argv) {
         create_info.imageExtent = swap_chain_extent;
         create_info.imageArrayLayers = 1;
         create_info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        if (options.dynamic_resolution) {
+            create_info.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        }
+        if (capturing) {
+            create_info.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        }
 
         // Some extra configuration depending on whether the graphics and
         // present queue families are different. We must either explicitly
@@ -701,15 +5436,16 @@ int main(int argc, char** argv) {
         create_info.clipped = VK_TRUE;
         create_info.oldSwapchain = VK_NULL_HANDLE;
 
-        if ((result = vkCreateSwapchainKHR(device, &create_info, NULL, &swap_chain)) != VK_SUCCESS) {
-            std::cerr << "Failed to create swap chain: " << string_VkResult(result) << "\n";
+        if ((result = vkCreateSwapchainKHR(device, &create_info, apiAllocCallbacks, &swap_chain)) != VK_SUCCESS) {
+            log_error() << "Failed to create swap chain: " << string_VkResult(result);
             return 1;
         }
 
-        std::cout << "Created swap chain\n";
+        log_info() << "Created swap chain";
+        ++swap_chain_generation;
 
         vkGetSwapchainImagesKHR(device, swap_chain, &image_count, NULL);
-        std::vector<VkImage> swap_images(image_count);
+        swap_images.resize(image_count);
         vkGetSwapchainImagesKHR(device, swap_chain, &image_count, swap_images.data());
 
         // Create image views for our swap chain images
@@ -733,12 +5469,14 @@ int main(int argc, char** argv) {
             create_info.subresourceRange.layerCount = 1;
 
             if ((result = vkCreateImageView(device, &create_info, apiAllocCallbacks, &swap_image_views[i])) != VK_SUCCESS) {
-                std::cerr << "Failed to create swap chain image view " << i << ": " << string_VkResult(result) << "\n";
+                log_error() << "Failed to create swap chain image view " << i << ": " << string_VkResult(result);
                 return 1;
             }
         }
-        swap_framebuffers.resize(image_count);
-        for (std::size_t i = 0; i != swap_image_views.size(); ++i) {
+        // Dynamic rendering uses the image views directly, so there's
+        // nothing more to make here.
+        swap_framebuffers.assign(image_count, VK_NULL_HANDLE);
+        for (std::size_t i = 0; i != swap_image_views.size() && !options.dynamic_rendering; ++i) {
             VkFramebufferCreateInfo framebuffer_info{
                 .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
                 .pNext = NULL,
@@ -751,65 +5489,607 @@ int main(int argc, char** argv) {
             };
 
             if ((result = vkCreateFramebuffer(device, &framebuffer_info, apiAllocCallbacks, &swap_framebuffers[i])) != VK_SUCCESS) {
-                std::cerr << "Error creating framebuffer for swap image " << i << ": " << string_VkResult(result) << "\n";
+                log_error() << "Error creating framebuffer for swap image " << i << ": " << string_VkResult(result);
                 return 1;
             }
         }
+
+        if (options.dynamic_resolution) {
+            scaled_targets.resize(max_frames_in_flight);
+            for (std::size_t i = 0; i != scaled_targets.size(); ++i) {
+                auto &target = scaled_targets[i];
+                if (!create_image(target.image, target.memory, target.view, device, apiAllocCallbacks, device_memory_props, swap_chain_extent, 1, scene_format,
+                        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT)) {
+                    return 1;
+                }
+                target.framebuffer = VK_NULL_HANDLE;
+                if (!options.dynamic_rendering) {
+                    VkFramebufferCreateInfo framebuffer_info{
+                        .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+                        .pNext = NULL,
+                        .renderPass = scaled_render_pass,
+                        .attachmentCount = 1,
+                        .pAttachments = &target.view,
+                        .width = swap_chain_extent.width,
+                        .height = swap_chain_extent.height,
+                        .layers = 1
+                    };
+                    if ((result = vkCreateFramebuffer(device, &framebuffer_info, apiAllocCallbacks, &target.framebuffer)) != VK_SUCCESS) {
+                        log_error() << "Error creating framebuffer for scaled target " << i << ": " << string_VkResult(result);
+                        return 1;
+                    }
+                }
+            }
+        }
+
+        if (options.overdraw) {
+            overdraw_targets.resize(max_frames_in_flight);
+            for (std::size_t i = 0; i != overdraw_targets.size(); ++i) {
+                auto &overdraw = overdraw_targets[i];
+                auto &target = overdraw.target;
+                if (!create_image(target.image, target.memory, target.view, device, apiAllocCallbacks, device_memory_props, swap_chain_extent, 1, overdraw_format,
+                        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT)) {
+                    return 1;
+                }
+                target.framebuffer = VK_NULL_HANDLE;
+                if (!options.dynamic_rendering) {
+                    VkFramebufferCreateInfo framebuffer_info{
+                        .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+                        .pNext = NULL,
+                        .renderPass = overdraw_render_pass,
+                        .attachmentCount = 1,
+                        .pAttachments = &target.view,
+                        .width = swap_chain_extent.width,
+                        .height = swap_chain_extent.height,
+                        .layers = 1
+                    };
+                    if ((result = vkCreateFramebuffer(device, &framebuffer_info, apiAllocCallbacks, &target.framebuffer)) != VK_SUCCESS) {
+                        log_error() << "Error creating framebuffer for overdraw target " << i << ": " << string_VkResult(result);
+                        return 1;
+                    }
+                }
+                const uint32_t bytes = swap_chain_extent.width * swap_chain_extent.height * 2;
+                if (!create_buffer(overdraw.readback, overdraw.readback_memory, device, apiAllocCallbacks, device_memory_props, bytes,
+                        VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+                    return 1;
+                }
+                void *ptr = nullptr;
+                if ((result = vkMapMemory(device, overdraw.readback_memory, 0, VK_WHOLE_SIZE, 0, &ptr)) != VK_SUCCESS) {
+                    log_error() << "Failed to map overdraw readback buffer: " << string_VkResult(result);
+                    return 1;
+                }
+                overdraw.counts = static_cast<const uint16_t *>(ptr);
+                overdraw.extent.reset();
+            }
+        }
         return 0;
     };
+    const auto swap_chain_begin = std::chrono::steady_clock::now();
     if (create_swap_chain()) {
         return 1;
     }
+    const double create_swap_chain_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - swap_chain_begin).count();
+
+    // The mesh every object is drawn with, and its levels of detail as more
+    // ranges of the index buffer.
+    std::vector<float> vertex_data;
+    std::vector<uint16_t> index_data;
+    build_grid_mesh(static_cast<uint32_t>(options.mesh_detail), vertex_data, index_data);
+    const auto lod_build_begin = std::chrono::steady_clock::now();
+    const std::vector<MeshLod> mesh_lods = build_lods(vertex_data, 7, index_data, 8);
+    const double lod_build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - lod_build_begin).count();
 
     // create vertex buffer
-    const uint32_t n_vertices = 4;
-    const uint32_t bytes_per_vertex = 4 * 5;
+    const uint32_t n_vertices = static_cast<uint32_t>(vertex_data.size() / 7);
+    const uint32_t bytes_per_vertex = 4 * 7;
     VkBuffer vb = VK_NULL_HANDLE;
     VkDeviceMemory vb_alloc = VK_NULL_HANDLE;
     VkBuffer vb_staging = VK_NULL_HANDLE;
     VkDeviceMemory vb_staging_alloc = VK_NULL_HANDLE;
 
-    if (!create_buffer(vb_staging, vb_staging_alloc, device, device_memory_props, bytes_per_vertex * n_vertices, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+    if (!create_buffer(vb_staging, vb_staging_alloc, device, apiAllocCallbacks, device_memory_props, bytes_per_vertex * n_vertices, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
         return 1;
     }
     // Upload the vertex data via Map
     {
-        float vertex_data[] = {
-            -0.5f, -0.5f, 1.0f, 1.0f, 1.0f, // Top left
-             0.5f, -0.5f, 1.0f, 0.0f, 0.0f, // Top right
-             0.5f,  0.5f, 0.0f, 0.0f, 1.0f, // Bottom right
-            -0.5f,  0.5f, 0.0f, 1.0f, 0.0f, // Bottom left
-        };
-        const std::size_t bytes = sizeof(vertex_data);
+        const std::size_t bytes = vertex_data.size() * sizeof(float);
         void *ptr = nullptr;
         vkMapMemory(device, vb_staging_alloc, 0, bytes, 0, &ptr);
-        std::memcpy(ptr, vertex_data, bytes);
+        std::memcpy(ptr, vertex_data.data(), bytes);
         vkUnmapMemory(device, vb_staging_alloc);
     }
-    if (!create_buffer(vb, vb_alloc, device, device_memory_props, bytes_per_vertex * n_vertices, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
+    if (!create_buffer(vb, vb_alloc, device, apiAllocCallbacks, device_memory_props, bytes_per_vertex * n_vertices, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
         return 1;
     }
 
-    const uint32_t n_indices = 6;
+    const uint32_t n_indices = static_cast<uint32_t>(index_data.size());
     const uint32_t bytes_per_index = 2;
     VkBuffer ib, ib_staging;
     VkDeviceMemory ib_alloc, ib_staging_alloc;
-    if (!create_buffer(ib_staging, ib_staging_alloc, device, device_memory_props, bytes_per_index * n_indices, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+    if (!create_buffer(ib_staging, ib_staging_alloc, device, apiAllocCallbacks, device_memory_props, bytes_per_index * n_indices, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
         return 1;
     }
     {
-        uint16_t indices_data[] = {
-            0, 1, 2, 2, 3, 0,
-        };
         const std::size_t bytes = bytes_per_index * n_indices;
         void *ptr = nullptr;
         vkMapMemory(device, ib_staging_alloc, 0, bytes, 0, &ptr);
-        std::memcpy(ptr, indices_data, bytes);
+        std::memcpy(ptr, index_data.data(), bytes);
         vkUnmapMemory(device, ib_staging_alloc);
     }
-    if (!create_buffer(ib, ib_alloc, device, device_memory_props, bytes_per_index * n_indices, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
+    if (!create_buffer(ib, ib_alloc, device, apiAllocCallbacks, device_memory_props, bytes_per_index * n_indices, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
+        return 1;
+    }
+
+    // Particles. There's a buffer per frame in flight: each frame's compute
+    // step reads the one before's and writes its own, which that frame's
+    // graphics then draws from, so the compute for one frame can run while
+    // the last is still being drawn. The buffers are shared concurrently
+    // between the two queues rather than passed back and forth.
+    const uint32_t n_particles = static_cast<uint32_t>(options.particles);
+    std::vector<VkBuffer> particle_buffers;
+    std::vector<VkDeviceMemory> particle_allocs;
+    VkBuffer particle_staging = VK_NULL_HANDLE;
+    VkDeviceMemory particle_staging_alloc = VK_NULL_HANDLE;
+    VkDescriptorSetLayout particle_set_layout = VK_NULL_HANDLE;
+    VkPipelineLayout compute_layout = VK_NULL_HANDLE;
+    VkPipeline compute_pipeline = VK_NULL_HANDLE;
+    VkDescriptorPool particle_descriptor_pool = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> particle_sets;
+    VkCommandPool compute_command_pool = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> compute_cmds;
+    // Signalled by each frame's compute step, waited on by its graphics.
+    std::vector<VkSemaphore> particles_ready_sem;
+    // Two timestamps per frame in flight around the compute step.
+    VkQueryPool compute_timestamp_pool = VK_NULL_HANDLE;
+    if (n_particles != 0) {
+        const uint32_t particle_bytes = n_particles * static_cast<uint32_t>(sizeof(Particle));
+        std::vector<uint32_t> sharing_families = {static_cast<uint32_t>(queue_graphics_family)};
+        if (async_compute) {
+            sharing_families.push_back(static_cast<uint32_t>(queue_compute_family));
+        }
+        particle_buffers.resize(max_frames_in_flight, VK_NULL_HANDLE);
+        particle_allocs.resize(max_frames_in_flight, VK_NULL_HANDLE);
+        for (std::size_t i = 0; i != max_frames_in_flight; ++i) {
+            if (!create_buffer(particle_buffers[i], particle_allocs[i], device, apiAllocCallbacks, device_memory_props, particle_bytes,
+                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, sharing_families)) {
+                return 1;
+            }
+        }
+
+        // Everything starts scattered over the top half of the screen, and
+        // gets copied into every buffer with the initial upload.
+        if (!create_buffer(particle_staging, particle_staging_alloc, device, apiAllocCallbacks, device_memory_props, particle_bytes,
+                VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+            return 1;
+        }
+        {
+            void *ptr = nullptr;
+            vkMapMemory(device, particle_staging_alloc, 0, particle_bytes, 0, &ptr);
+            Particle *particles = static_cast<Particle *>(ptr);
+            uint32_t state = 0x9e3779b9u;
+            auto random = [&state] {
+                // xorshift32, plenty for scattering particles about.
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                return static_cast<float>(state & 0xffffu) / 65535.0f;
+            };
+            for (uint32_t i = 0; i != n_particles; ++i) {
+                particles[i] = {
+                    .x = 2.0f * random() - 1.0f,
+                    .y = -random(),
+                    .vx = random() - 0.5f,
+                    .vy = 0.0f,
+                };
+            }
+            vkUnmapMemory(device, particle_staging_alloc);
+        }
+
+        VkDescriptorSetLayoutBinding particle_bindings[2];
+        for (uint32_t b = 0; b != 2; ++b) {
+            particle_bindings[b] = {
+                .binding = b,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .descriptorCount = 1,
+                .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+                .pImmutableSamplers = NULL,
+            };
+        }
+        VkDescriptorSetLayoutCreateInfo set_layout_info{
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .bindingCount = 2,
+            .pBindings = particle_bindings,
+        };
+        if ((result = vkCreateDescriptorSetLayout(device, &set_layout_info, apiAllocCallbacks, &particle_set_layout)) != VK_SUCCESS) {
+            log_error() << "Failed to create particle descriptor set layout: " << string_VkResult(result);
+            return 1;
+        }
+        VkPushConstantRange step_constants{
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .offset = 0,
+            .size = sizeof(ParticleStep),
+        };
+        VkPipelineLayoutCreateInfo layout_info{
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .setLayoutCount = 1,
+            .pSetLayouts = &particle_set_layout,
+            .pushConstantRangeCount = 1,
+            .pPushConstantRanges = &step_constants,
+        };
+        if ((result = vkCreatePipelineLayout(device, &layout_info, apiAllocCallbacks, &compute_layout)) != VK_SUCCESS) {
+            log_error() << "Failed to create compute pipeline layout: " << string_VkResult(result);
+            return 1;
+        }
+        VkComputePipelineCreateInfo compute_info{
+            .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .stage = {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                .pNext = NULL,
+                .flags = 0,
+                .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+                .module = particle_compute_module,
+                .pName = "main",
+                .pSpecializationInfo = NULL,
+            },
+            .layout = compute_layout,
+            .basePipelineHandle = VK_NULL_HANDLE,
+            .basePipelineIndex = -1,
+        };
+        if ((result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &compute_info, apiAllocCallbacks, &compute_pipeline)) != VK_SUCCESS) {
+            log_error() << "Failed to create compute pipeline: " << string_VkResult(result);
+            return 1;
+        }
+
+        // Slot i reads the slot before's buffer and writes its own.
+        VkDescriptorPoolSize pool_size{
+            .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 2 * max_frames_in_flight,
+        };
+        VkDescriptorPoolCreateInfo pool_info{
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .maxSets = max_frames_in_flight,
+            .poolSizeCount = 1,
+            .pPoolSizes = &pool_size,
+        };
+        if ((result = vkCreateDescriptorPool(device, &pool_info, apiAllocCallbacks, &particle_descriptor_pool)) != VK_SUCCESS) {
+            log_error() << "Failed to create particle descriptor pool: " << string_VkResult(result);
+            return 1;
+        }
+        particle_sets.resize(max_frames_in_flight);
+        std::vector<VkDescriptorSetLayout> layouts(max_frames_in_flight, particle_set_layout);
+        VkDescriptorSetAllocateInfo alloc_info{
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            .pNext = NULL,
+            .descriptorPool = particle_descriptor_pool,
+            .descriptorSetCount = max_frames_in_flight,
+            .pSetLayouts = layouts.data(),
+        };
+        if ((result = vkAllocateDescriptorSets(device, &alloc_info, particle_sets.data())) != VK_SUCCESS) {
+            log_error() << "Failed to allocate particle descriptor sets: " << string_VkResult(result);
+            return 1;
+        }
+        std::vector<VkDescriptorBufferInfo> buffer_infos(2 * max_frames_in_flight);
+        std::vector<VkWriteDescriptorSet> writes;
+        for (uint32_t i = 0; i != max_frames_in_flight; ++i) {
+            buffer_infos[2 * i] = {
+                .buffer = particle_buffers[(i + max_frames_in_flight - 1) % max_frames_in_flight],
+                .offset = 0,
+                .range = VK_WHOLE_SIZE,
+            };
+            buffer_infos[2 * i + 1] = {
+                .buffer = particle_buffers[i],
+                .offset = 0,
+                .range = VK_WHOLE_SIZE,
+            };
+            for (uint32_t b = 0; b != 2; ++b) {
+                writes.push_back({
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .pNext = NULL,
+                    .dstSet = particle_sets[i],
+                    .dstBinding = b,
+                    .dstArrayElement = 0,
+                    .descriptorCount = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    .pImageInfo = NULL,
+                    .pBufferInfo = &buffer_infos[2 * i + b],
+                    .pTexelBufferView = NULL,
+                });
+            }
+        }
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, NULL);
+
+        VkCommandPoolCreateInfo command_pool_info{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .pNext = NULL,
+            .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+            .queueFamilyIndex = static_cast<uint32_t>(queue_compute_family),
+        };
+        if ((result = vkCreateCommandPool(device, &command_pool_info, apiAllocCallbacks, &compute_command_pool)) != VK_SUCCESS) {
+            log_error() << "Failed to create command pool for compute queue: " << string_VkResult(result);
+            return 1;
+        }
+        compute_cmds.resize(max_frames_in_flight);
+        VkCommandBufferAllocateInfo cmd_alloc_info{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .pNext = NULL,
+            .commandPool = compute_command_pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = max_frames_in_flight,
+        };
+        if ((result = vkAllocateCommandBuffers(device, &cmd_alloc_info, compute_cmds.data())) != VK_SUCCESS) {
+            log_error() << "Failed to create compute command buffers: " << string_VkResult(result);
+            return 1;
+        }
+
+        particles_ready_sem.resize(max_frames_in_flight, VK_NULL_HANDLE);
+        VkSemaphoreCreateInfo semaphore_info{
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+        };
+        for (auto &sem : particles_ready_sem) {
+            if ((result = vkCreateSemaphore(device, &semaphore_info, apiAllocCallbacks, &sem)) != VK_SUCCESS) {
+                log_error() << "Failed to create particle semaphore: " << string_VkResult(result);
+                return 1;
+            }
+        }
+
+        if (compute_timestamp_bits != 0) {
+            VkQueryPoolCreateInfo query_info{
+                .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                .pNext = NULL,
+                .flags = 0,
+                .queryType = VK_QUERY_TYPE_TIMESTAMP,
+                .queryCount = 2 * max_frames_in_flight,
+            };
+            if ((result = vkCreateQueryPool(device, &query_info, apiAllocCallbacks, &compute_timestamp_pool)) != VK_SUCCESS) {
+                log_error() << "Failed to create compute timestamp query pool: " << string_VkResult(result);
+                return 1;
+            }
+        }
+    }
+
+    // Textures. Everything sampled goes through the streamer; until its first
+    // level arrives we draw with a 1x1 white placeholder instead.
+    VkSampler sampler;
+    {
+        VkSamplerCreateInfo sampler_info{
+            .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .magFilter = VK_FILTER_LINEAR,
+            .minFilter = VK_FILTER_LINEAR,
+            .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+            .addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+            .addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+            .addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+            .mipLodBias = 0.0f,
+            .anisotropyEnable = VK_FALSE,
+            .maxAnisotropy = 1.0f,
+            .compareEnable = VK_FALSE,
+            .compareOp = VK_COMPARE_OP_ALWAYS,
+            .minLod = 0.0f,
+            // Each image only holds its resident levels, so let the sampler
+            // use however many there are.
+            .maxLod = VK_LOD_CLAMP_NONE,
+            .borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK,
+            .unnormalizedCoordinates = VK_FALSE,
+        };
+        if ((result = vkCreateSampler(device, &sampler_info, apiAllocCallbacks, &sampler)) != VK_SUCCESS) {
+            log_error() << "Failed to create sampler: " << string_VkResult(result);
+            return 1;
+        }
+    }
+
+    VkImage placeholder_image;
+    VkDeviceMemory placeholder_memory;
+    VkImageView placeholder_view;
+    VkBuffer placeholder_staging;
+    VkDeviceMemory placeholder_staging_alloc;
+    if (!create_image(placeholder_image, placeholder_memory, placeholder_view, device, apiAllocCallbacks, device_memory_props, {1, 1}, 1, VK_FORMAT_R8G8B8A8_UNORM,
+            VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT)) {
+        return 1;
+    }
+    if (!create_buffer(placeholder_staging, placeholder_staging_alloc, device, apiAllocCallbacks, device_memory_props, 4, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+        return 1;
+    }
+    {
+        const uint8_t white[4] = {255, 255, 255, 255};
+        void *ptr = nullptr;
+        vkMapMemory(device, placeholder_staging_alloc, 0, sizeof(white), 0, &ptr);
+        std::memcpy(ptr, white, sizeof(white));
+        vkUnmapMemory(device, placeholder_staging_alloc);
+    }
+
+    TextureStreamer streamer(device, apiAllocCallbacks, device_memory_props, max_frames_in_flight,
+        options.texture_budget_mb * 1024 * 1024, options.upload_budget_mb * 1024 * 1024);
+    if (options.texture_paths.empty()) {
+        streamer.add_checkerboard(1024);
+    }
+    for (const auto &path : options.texture_paths) {
+        if (!streamer.add_ktx2(path, options.bundle_path.empty() ? nullptr : &bundle)) {
+            return 1;
+        }
+    }
+    for (std::size_t i = 0; i != streamer.size(); ++i) {
+        VkFormatProperties format_props;
+        vkGetPhysicalDeviceFormatProperties(physical_device, streamer.texture(i).format, &format_props);
+        if (!(format_props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)) {
+            log_error() << "Texture " << streamer.texture(i).name << " has format " << string_VkFormat(streamer.texture(i).format)
+                        << " which this device can't sample";
+            return 1;
+        }
+    }
+    // Things to destroy once the GPU is done with them, tagged with the
+    // frame value (see frame_timeline below) that has to complete first.
+    std::deque<std::pair<uint64_t, std::function<void()>>> deferred_deletions;
+    std::vector<std::function<void()>> frame_deletions;
+
+    // Per-object transforms, the rows of a 2x3 matrix padded to vec4s, from
+    // the scene graph. They're rewritten every frame, straight into the
+    // mapped buffer for the frame slot. Classic mode reads them at a dynamic
+    // offset, which has to be aligned.
+    const uint32_t n_objects = static_cast<uint32_t>(options.draws);
+    const VkDeviceSize object_stride = options.bindless ? 32 : std::max<VkDeviceSize>(32, device_props.limits.minUniformBufferOffsetAlignment);
+    const uint32_t grid_columns = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(n_objects))));
+    // As in build_grid_scene, for working out how big each quad is on screen.
+    const float object_scale = std::min(1.0f, 1.8f / grid_columns);
+    Scene scene;
+    build_grid_scene(scene, n_objects, options.spin * 0.0174532925f);
+    // Only big scenes are worth spreading over threads.
+    std::optional<ThreadPool> scene_pool;
+    if (n_objects >= Scene::parallel_threshold && load_threads > 1) {
+        scene_pool.emplace(load_threads - 1, "Scene");
+    }
+    scene.build(load_threads);
+    // Where each object ends up, kept up to date by the scene update, and a
+    // BVH over them for culling and picking. Without culling everything is
+    // visible.
+    std::vector<Aabb> object_bounds(n_objects);
+    scene.update(0.0f, nullptr, 0, object_bounds.data(), scene_pool ? &*scene_pool : nullptr);
+    Bvh bvh;
+    const auto bvh_begin = std::chrono::steady_clock::now();
+    bvh.build(object_bounds);
+    const double bvh_build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - bvh_begin).count();
+    std::vector<uint32_t> visible(n_objects);
+    for (uint32_t i = 0; i != n_objects; ++i) {
+        visible[i] = i;
+    }
+    double cull_seconds = 0.0, refit_seconds = 0.0;
+    uint64_t objects_culled = 0;
+    // Each object's level of detail, all full detail with LOD off, which L
+    // toggles. Triangles drawn and frame times are kept for each, to compare.
+    bool lod_enabled = options.lod;
+    std::vector<uint8_t> object_lods(n_objects);
+    uint64_t frame_triangles = 0;
+    uint64_t lod_triangles[2] = {}, lod_frames[2] = {};
+    double lod_frame_seconds[2] = {};
+    std::optional<std::chrono::steady_clock::time_point> last_frame_end;
+    const auto scene_begin = std::chrono::steady_clock::now();
+    double scene_seconds = 0.0;
+    // With --tick-rate the scene is stepped on the simulation thread, and
+    // frames draw it between the last two ticks they've seen. Which slot's
+    // object buffer holds what was last drawn, for picking, as the scene's
+    // own transforms belong to the other thread.
+    std::optional<Simulation> simulation;
+    Simulation::Snapshot sim_previous, sim_current;
+    std::optional<uint32_t> drawn_objects_slot;
+    std::vector<VkBuffer> object_buffers(max_frames_in_flight, VK_NULL_HANDLE);
+    std::vector<VkDeviceMemory> object_buffer_allocs(max_frames_in_flight, VK_NULL_HANDLE);
+    std::vector<uint8_t *> objects_mapped(max_frames_in_flight);
+    for (std::size_t i = 0; i != max_frames_in_flight; ++i) {
+        if (!create_buffer(object_buffers[i], object_buffer_allocs[i], device, apiAllocCallbacks, device_memory_props, static_cast<uint32_t>(object_stride * n_objects),
+                options.bindless ? VK_BUFFER_USAGE_STORAGE_BUFFER_BIT : VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+            return 1;
+        }
+        void *ptr = nullptr;
+        if ((result = vkMapMemory(device, object_buffer_allocs[i], 0, VK_WHOLE_SIZE, 0, &ptr)) != VK_SUCCESS) {
+            log_error() << "Failed to map object buffer: " << string_VkResult(result);
+            return 1;
+        }
+        objects_mapped[i] = static_cast<uint8_t *>(ptr);
+    }
+
+    // Classic mode has a set per texture per frame in flight, bindless one
+    // set per frame in flight holding everything. Either way each frame in
+    // flight has its own, as a texture's image can change from one frame to
+    // the next while the previous is still using its set.
+    const uint32_t n_textures = static_cast<uint32_t>(streamer.size());
+    if (options.bindless && n_textures > bindless_texture_slots) {
+        log_error() << "Too many textures for the bindless table (" << bindless_texture_slots << " slots)";
         return 1;
     }
+    const uint32_t sets_per_frame = options.bindless ? 1 : n_textures;
+    VkDescriptorPool descriptor_pool;
+    std::vector<VkDescriptorSet> descriptor_sets(max_frames_in_flight * sets_per_frame);
+    // The view each texture descriptor currently points at, to skip
+    // rewriting ones that haven't changed.
+    std::vector<VkImageView> bound_views(max_frames_in_flight * n_textures, VK_NULL_HANDLE);
+    {
+        const uint32_t n_sets = static_cast<uint32_t>(descriptor_sets.size());
+        VkDescriptorPoolSize pool_sizes[] = {
+            {
+                .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                .descriptorCount = n_sets * (options.bindless ? bindless_texture_slots : 1),
+            },
+            {
+                .type = options.bindless ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                .descriptorCount = n_sets * (options.bindless ? bindless_buffer_slots : 1),
+            },
+        };
+        VkDescriptorPoolCreateInfo pool_info{
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+            .pNext = NULL,
+            .flags = options.bindless ? static_cast<VkDescriptorPoolCreateFlags>(VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT) : 0u,
+            .maxSets = n_sets,
+            .poolSizeCount = 2,
+            .pPoolSizes = pool_sizes,
+        };
+        if ((result = vkCreateDescriptorPool(device, &pool_info, apiAllocCallbacks, &descriptor_pool)) != VK_SUCCESS) {
+            log_error() << "Failed to create descriptor pool: " << string_VkResult(result);
+            return 1;
+        }
+        std::vector<VkDescriptorSetLayout> layouts(n_sets, set_layout);
+        VkDescriptorSetAllocateInfo alloc_info{
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            .pNext = NULL,
+            .descriptorPool = descriptor_pool,
+            .descriptorSetCount = n_sets,
+            .pSetLayouts = layouts.data(),
+        };
+        if ((result = vkAllocateDescriptorSets(device, &alloc_info, descriptor_sets.data())) != VK_SUCCESS) {
+            log_error() << "Failed to allocate descriptor sets: " << string_VkResult(result);
+            return 1;
+        }
+
+        // Each frame slot's object buffer never changes, so point its sets at
+        // it now. Bindless puts it in slot 0 of the buffer table and indexes
+        // the whole thing, classic sees one object at a time.
+        std::vector<VkDescriptorBufferInfo> buffer_infos(max_frames_in_flight);
+        for (std::size_t i = 0; i != max_frames_in_flight; ++i) {
+            buffer_infos[i] = {
+                .buffer = object_buffers[i],
+                .offset = 0,
+                .range = options.bindless ? VK_WHOLE_SIZE : 32,
+            };
+        }
+        std::vector<VkWriteDescriptorSet> writes;
+        for (std::size_t i = 0; i != descriptor_sets.size(); ++i) {
+            writes.push_back({
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .pNext = NULL,
+                .dstSet = descriptor_sets[i],
+                .dstBinding = 1,
+                .dstArrayElement = 0,
+                .descriptorCount = 1,
+                .descriptorType = options.bindless ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                .pImageInfo = NULL,
+                .pBufferInfo = &buffer_infos[i / sets_per_frame],
+                .pTexelBufferView = NULL,
+            });
+        }
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, NULL);
+    }
+
+    // For the draw submission benchmark.
+    double record_seconds = 0.0;
+    uint64_t draws_recorded = 0;
+    double gpu_ms_total = 0.0;
+    uint64_t gpu_frames = 0;
+    // CPU time spent on frame pacing: resetting fences or reading the
+    // timeline, retiring deferred deletions and submitting. Blocking waits
+    // aren't counted, as that's the GPU's time not ours.
+    double sync_seconds = 0.0;
 
 
     VkCommandPool command_pool;
@@ -825,14 +6105,11 @@ int main(int argc, char** argv) {
         };
 
         if ((result = vkCreateCommandPool(device, &pool_info, apiAllocCallbacks, &command_pool)) != VK_SUCCESS) {
-            std::cerr << "Failed to create command pool for graphics queue: " << string_VkResult(result) << "\n";
+            log_error() << "Failed to create command pool for graphics queue: " << string_VkResult(result);
             return 1;
         }
     }
 
-    // Setup to handle N frames in flight
-    const int max_frames_in_flight = 2;
-
     std::vector<VkCommandBuffer> command_buffer(max_frames_in_flight);
     {
         VkCommandBufferAllocateInfo alloc_info{
@@ -843,14 +6120,43 @@ int main(int argc, char** argv) {
         };
 
         if ((result = vkAllocateCommandBuffers(device, &alloc_info, command_buffer.data())) != VK_SUCCESS) {
-            std::cerr << "Failed to create command buffer: " << string_VkResult(result) << "\n";
+            log_error() << "Failed to create command buffer: " << string_VkResult(result);
             return 1;
         }
     }
 
+    // With --reuse-commands, command_buffer only carries the per-frame work
+    // (query resets and texture uploads) and the scene comes from here,
+    // indexed by frame slot then swap image. An entry is stale if the
+    // slot's descriptors, the swap chain or the render scale have changed
+    // since it was recorded.
+    struct CachedCommands {
+        VkCommandBuffer cmd = VK_NULL_HANDLE;
+        uint64_t version = 0;
+        uint64_t swap_chain_generation = 0;
+        float scale = 0.0f;
+    };
+    std::vector<CachedCommands> cached_commands;
+    std::vector<uint64_t> slot_versions(max_frames_in_flight, 1);
+    // What each slot's scene last drew, when culling, and at what detail.
+    std::vector<std::vector<uint32_t>> slot_visible(max_frames_in_flight);
+    std::vector<std::vector<uint8_t>> slot_lods(max_frames_in_flight);
+    uint64_t commands_recorded = 0, commands_reused = 0;
+    // CPU time from acquiring to having submitted, i.e. the part of the
+    // frame reuse saves on.
+    double frame_cpu_seconds = 0.0;
+
     std::vector<VkSemaphore> image_available_sem(max_frames_in_flight);
     std::vector<VkSemaphore> render_finished_sem(max_frames_in_flight);
-    std::vector<VkFence> in_flight_fence(max_frames_in_flight);
+    std::vector<VkFence> in_flight_fence(max_frames_in_flight, VK_NULL_HANDLE);
+    // With timeline semaphores, in place of the fences: frame N (counting
+    // from 0) signals timeline_base + N + 1 when it completes, and the
+    // initial upload signals timeline_base. Without, the same values are
+    // worked out from which fences we've waited on. Either way everything
+    // that waits on the GPU keys off this one number.
+    VkSemaphore frame_timeline = VK_NULL_HANDLE;
+    const uint64_t timeline_base = options.timeline_semaphores ? 1 : 0;
+    uint64_t completed_value = 0;
     // next_frame always % max_frames_in_flight
     uint32_t next_frame = 0;
     {
@@ -863,21 +6169,223 @@ int main(int argc, char** argv) {
         };
         for (std::size_t i = 0; i != max_frames_in_flight; ++i) {
             if ((result = vkCreateSemaphore(device, &semaphore_info, apiAllocCallbacks, &image_available_sem[i])) != VK_SUCCESS) {
-                std::cerr << "Failed to create semaphore: " << string_VkResult(result) << "\n";
+                log_error() << "Failed to create semaphore: " << string_VkResult(result);
                 return 1;
             }
             if ((result = vkCreateSemaphore(device, &semaphore_info, apiAllocCallbacks, &render_finished_sem[i])) != VK_SUCCESS) {
-                std::cerr << "Failed to create semaphore: " << string_VkResult(result) << "\n";
+                log_error() << "Failed to create semaphore: " << string_VkResult(result);
+                return 1;
+            }
+            if (!options.timeline_semaphores &&
+                (result = vkCreateFence(device, &fence_info, apiAllocCallbacks, &in_flight_fence[i])) != VK_SUCCESS) {
+                log_error() << "Failed to create fence: " << string_VkResult(result);
                 return 1;
             }
-            if ((result = vkCreateFence(device, &fence_info, apiAllocCallbacks, &in_flight_fence[i])) != VK_SUCCESS) {
-                std::cerr << "Failed to create fence: " << string_VkResult(result) << "\n";
+        }
+        if (options.timeline_semaphores) {
+            VkSemaphoreTypeCreateInfo type_info{
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+                .pNext = NULL,
+                .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+                .initialValue = 0,
+            };
+            VkSemaphoreCreateInfo timeline_info{
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+                .pNext = &type_info,
+                .flags = 0,
+            };
+            if ((result = vkCreateSemaphore(device, &timeline_info, apiAllocCallbacks, &frame_timeline)) != VK_SUCCESS) {
+                log_error() << "Failed to create timeline semaphore: " << string_VkResult(result);
                 return 1;
             }
         }
-    }
+    }
+
+    // Two timestamps per frame in flight bracketing the scene rendering, so
+    // we know how long the GPU actually spent on each frame.
+    VkQueryPool timestamp_pool = VK_NULL_HANDLE;
+    std::vector<bool> timestamps_written(max_frames_in_flight, false);
+    if (graphics_timestamp_bits != 0) {
+        VkQueryPoolCreateInfo query_info{
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = 2 * max_frames_in_flight,
+        };
+        if ((result = vkCreateQueryPool(device, &query_info, apiAllocCallbacks, &timestamp_pool)) != VK_SUCCESS) {
+            log_error() << "Failed to create timestamp query pool: " << string_VkResult(result);
+            return 1;
+        }
+    }
+
+    // One pipeline statistics query per frame in flight around the scene
+    // pass. Results come back in bit order, one uint64_t per statistic.
+    VkQueryPool stats_pool = VK_NULL_HANDLE;
+    const char *stat_names[] = {"input assembly vertices", "input assembly primitives", "vertex shader invocations",
+                                "clipping primitives", "fragment shader invocations"};
+    const uint32_t n_stats = sizeof(stat_names) / sizeof(stat_names[0]);
+    std::vector<bool> stats_written(max_frames_in_flight, false);
+    std::vector<uint64_t> stats_total(n_stats, 0);
+    uint64_t stats_frames = 0;
+    if (options.pipeline_stats) {
+        VkQueryPoolCreateInfo query_info{
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .pNext = NULL,
+            .flags = 0,
+            .queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+            .queryCount = max_frames_in_flight,
+            .pipelineStatistics =
+                VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+                VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+                VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+                VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+                VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT,
+        };
+        if ((result = vkCreateQueryPool(device, &query_info, apiAllocCallbacks, &stats_pool)) != VK_SUCCESS) {
+            log_error() << "Failed to create pipeline statistics query pool: " << string_VkResult(result);
+            return 1;
+        }
+    }
+    // Fragments shaded per pixel, over every frame with overdraw counted.
+    uint64_t overdraw_frames = 0;
+    double overdraw_total = 0.0, overdraw_max = 0.0;
+
+    ResolutionController resolution{
+        .target_ms = options.frame_budget_ms,
+        .min_scale = options.min_render_scale,
+    };
+    // Scale each in-flight frame was rendered at, for logging once its
+    // timings come back.
+    std::vector<float> frame_scale(max_frames_in_flight, 1.0f);
+    std::vector<uint64_t> frame_index(max_frames_in_flight, 0);
+    uint64_t frame_count = 0;
+
+    // Latency limiting and measurement, which need timestamps to know when
+    // frames actually finish. Times are steady_clock milliseconds.
+    if ((options.low_latency || options.fps_cap > 0.0f) && timestamp_pool == VK_NULL_HANDLE) {
+        log_warning() << "Graphics queue doesn't support timestamps, disabling the latency limiter";
+        options.low_latency = false;
+    }
+    LatencyLimiter limiter{
+        .min_interval_ms = options.fps_cap > 0.0f ? 1000.0 / options.fps_cap : 0.0,
+    };
+    auto now_ms = [] {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    };
+    // When each in-flight frame sampled input and was submitted, and when its
+    // GPU work ended (GPU clock) once known.
+    std::vector<double> frame_sample_ms(max_frames_in_flight, 0.0);
+    std::vector<double> frame_submit_ms(max_frames_in_flight, 0.0);
+    std::vector<std::optional<double>> frame_gpu_end_ms(max_frames_in_flight);
+    double last_sample_ms = 0.0;
+    uint64_t latency_frames = 0;
+    double latency_ms_total = 0.0, latency_ms_max = 0.0;
+    const uint64_t timestamp_mask = graphics_timestamp_bits >= 64 ? ~0ull : (1ull << graphics_timestamp_bits) - 1;
+    auto gpu_ticks_to_ms = [&](uint64_t ticks) {
+        return (ticks & timestamp_mask) * device_props.limits.timestampPeriod / 1e6;
+    };
+    // Same for the compute queue, which may count fewer bits, but ticks are
+    // the same length on every queue.
+    const uint64_t compute_timestamp_mask = compute_timestamp_bits >= 64 ? ~0ull : (1ull << compute_timestamp_bits) - 1;
+    auto compute_ticks_to_ms = [&](uint64_t ticks) {
+        return (ticks & compute_timestamp_mask) * device_props.limits.timestampPeriod / 1e6;
+    };
+    // CPU time minus compute queue time. Timestamps from different queues
+    // can't be compared directly, so this is only known when both can be put
+    // on our clock by reading it together with the GPU's.
+    std::optional<double> compute_offset_ms;
+
+    // Read the GPU clock and ours together, if the device lets us. Redone
+    // every so often to follow drift.
+    PFN_vkGetCalibratedTimestampsEXT get_calibrated_timestamps = nullptr;
+    if (calibrated_timestamps) {
+        get_calibrated_timestamps = reinterpret_cast<PFN_vkGetCalibratedTimestampsEXT>(
+            vkGetDeviceProcAddr(device, "vkGetCalibratedTimestampsEXT"));
+    }
+    auto calibrate_clocks = [&] {
+        if (!get_calibrated_timestamps) {
+            return;
+        }
+        const VkCalibratedTimestampInfoEXT infos[2] = {
+            {.sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, .pNext = NULL, .timeDomain = VK_TIME_DOMAIN_DEVICE_EXT},
+            {.sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT, .pNext = NULL, .timeDomain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT},
+        };
+        uint64_t timestamps[2];
+        uint64_t max_deviation;
+        if (get_calibrated_timestamps(device, 2, infos, timestamps, &max_deviation) == VK_SUCCESS) {
+            limiter.set_offset(timestamps[1] / 1e6 - gpu_ticks_to_ms(timestamps[0]));
+            if (compute_timestamp_bits != 0) {
+                compute_offset_ms = timestamps[1] / 1e6 - compute_ticks_to_ms(timestamps[0]);
+            }
+        }
+    };
+    calibrate_clocks();
+
+    // Readback ring for frame capture. A couple more slots than frames in
+    // flight gives the writer thread some slack before we start dropping.
+    std::vector<CaptureSlot> capture_slots(capturing ? max_frames_in_flight + 2 : 0);
+    // Slot each in-flight frame is copying into, handed to the writer once
+    // that frame's fence has signalled.
+    std::vector<CaptureSlot *> capture_pending(max_frames_in_flight, nullptr);
+    uint64_t captured_frames = 0, dropped_frames = 0, readback_bytes = 0;
+    // Readback is cached where possible since the writer reads it all, but
+    // then it may not be coherent.
+    VkMemoryPropertyFlags capture_memory_flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    if (!find_memory_type(device_memory_props, ~0u, capture_memory_flags)) {
+        capture_memory_flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    }
+    const bool capture_coherent = capture_memory_flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    auto capture_start = std::chrono::steady_clock::now();
+
+    // Hand a frame's readback to the writer once the GPU is done with it.
+    auto finish_capture = [&](std::size_t frame) {
+        CaptureSlot *slot = capture_pending[frame];
+        if (!slot) {
+            return;
+        }
+        capture_pending[frame] = nullptr;
+        if (!capture_coherent) {
+            VkMappedMemoryRange range{
+                .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+                .pNext = NULL,
+                .memory = slot->memory,
+                .offset = 0,
+                .size = VK_WHOLE_SIZE,
+            };
+            vkInvalidateMappedMemoryRanges(device, 1, &range);
+        }
+        frame_writer.submit(slot);
+    };
+
+    auto destroy_capture_slot = [&](CaptureSlot &slot) {
+        if (slot.buffer != VK_NULL_HANDLE) {
+            vkUnmapMemory(device, slot.memory);
+            vkDestroyBuffer(device, slot.buffer, apiAllocCallbacks);
+            vkFreeMemory(device, slot.memory, apiAllocCallbacks);
+            slot.buffer = VK_NULL_HANDLE;
+            slot.capacity = 0;
+        }
+    };
 
     auto cleanup_swap_chain = [&]{
+        for (auto &target : scaled_targets) {
+            vkDestroyFramebuffer(device, target.framebuffer, apiAllocCallbacks);
+            vkDestroyImageView(device, target.view, apiAllocCallbacks);
+            vkDestroyImage(device, target.image, apiAllocCallbacks);
+            vkFreeMemory(device, target.memory, apiAllocCallbacks);
+        }
+        scaled_targets.clear();
+        for (auto &overdraw : overdraw_targets) {
+            vkDestroyFramebuffer(device, overdraw.target.framebuffer, apiAllocCallbacks);
+            vkDestroyImageView(device, overdraw.target.view, apiAllocCallbacks);
+            vkDestroyImage(device, overdraw.target.image, apiAllocCallbacks);
+            vkFreeMemory(device, overdraw.target.memory, apiAllocCallbacks);
+            vkDestroyBuffer(device, overdraw.readback, apiAllocCallbacks);
+            vkFreeMemory(device, overdraw.readback_memory, apiAllocCallbacks);
+        }
+        overdraw_targets.clear();
+
         for (auto &fb : swap_framebuffers) {
             vkDestroyFramebuffer(device, fb, apiAllocCallbacks);
         }
@@ -888,15 +6396,25 @@ int main(int argc, char** argv) {
         vkDestroySwapchainKHR(device, swap_chain, apiAllocCallbacks);
     };
 
+    // Time spent tearing down and recreating the swap chain and everything
+    // sized to it, not counting waiting for the device to go idle first.
+    uint64_t swap_chain_recreations = 0;
+    double recreate_seconds = 0.0;
     auto recreate_swap_chain = [&]{
-        std::cout << "Recreating swap chain\n";
+        TraceZone zone("Recreate swap chain");
+        log_info() << "Recreating swap chain";
         vkDeviceWaitIdle(device);
+        const auto begin = std::chrono::steady_clock::now();
         cleanup_swap_chain();
-        return create_swap_chain();
+        const int status = create_swap_chain();
+        recreate_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        ++swap_chain_recreations;
+        return status;
     };
 
     // Perform initial vertex data copy to device local buffer.
     {
+        TraceZone zone("Initial upload");
         VkCommandPool init_cmd_pool;
         VkCommandPoolCreateInfo create_info{
             .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
@@ -907,7 +6425,7 @@ int main(int argc, char** argv) {
             .queueFamilyIndex = static_cast<uint32_t>(queue_graphics_family),
         };
         if ((result = vkCreateCommandPool(device, &create_info, apiAllocCallbacks, &init_cmd_pool)) != VK_SUCCESS) {
-            std::cerr << "Failed to create vertex data upload command pool: " << string_VkResult(result) << "\n";
+            log_error() << "Failed to create vertex data upload command pool: " << string_VkResult(result);
             return 1;
         }
 
@@ -921,7 +6439,7 @@ int main(int argc, char** argv) {
         };
 
         if ((result = vkAllocateCommandBuffers(device, &cmd_buf_info, &cmd_buf)) != VK_SUCCESS) {
-            std::cerr << "Failed to create vertex data upload command buffer: " << string_VkResult(result) << "\n";
+            log_error() << "Failed to create vertex data upload command buffer: " << string_VkResult(result);
             return 1;
         }
 
@@ -942,69 +6460,489 @@ int main(int argc, char** argv) {
         vkCmdCopyBuffer(cmd_buf, vb_staging, vb, 1, &copy_region);
         copy_region.size = bytes_per_index * n_indices;
         vkCmdCopyBuffer(cmd_buf, ib_staging, ib, 1, &copy_region);
+        if (n_particles != 0) {
+            // Each frame's compute step reads the previous slot's buffer, so
+            // seed them all.
+            copy_region.size = n_particles * sizeof(Particle);
+            for (VkBuffer buffer : particle_buffers) {
+                vkCmdCopyBuffer(cmd_buf, particle_staging, buffer, 1, &copy_region);
+            }
+            VkMemoryBarrier particles_uploaded{
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .pNext = NULL,
+                .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+            };
+            vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0,
+                1, &particles_uploaded, 0, NULL, 0, NULL);
+        }
+
+        VkImageMemoryBarrier placeholder_barrier{
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .pNext = NULL,
+            .srcAccessMask = 0,
+            .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = placeholder_image,
+            .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+        };
+        vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+            0, NULL, 0, NULL, 1, &placeholder_barrier);
+        VkBufferImageCopy placeholder_region{
+            .bufferOffset = 0,
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+            .imageOffset = {0, 0, 0},
+            .imageExtent = {1, 1, 1},
+        };
+        vkCmdCopyBufferToImage(cmd_buf, placeholder_staging, placeholder_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &placeholder_region);
+        placeholder_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        placeholder_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        placeholder_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        placeholder_barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+            0, NULL, 0, NULL, 1, &placeholder_barrier);
 
         vkEndCommandBuffer(cmd_buf);
 
+        // With a timeline the upload signals timeline_base, which the first
+        // frame waits on, rather than us stalling here until it's done.
+        VkTimelineSemaphoreSubmitInfo timeline_submit{
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .pNext = NULL,
+            .waitSemaphoreValueCount = 0,
+            .pWaitSemaphoreValues = NULL,
+            .signalSemaphoreValueCount = 1,
+            .pSignalSemaphoreValues = &timeline_base,
+        };
         VkSubmitInfo submit_info{
             .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext = options.timeline_semaphores ? &timeline_submit : NULL,
             .waitSemaphoreCount = 0,
             .commandBufferCount = 1,
             .pCommandBuffers = &cmd_buf,
-            .signalSemaphoreCount = 0,
+            .signalSemaphoreCount = options.timeline_semaphores ? 1u : 0u,
+            .pSignalSemaphores = &frame_timeline,
         };
         if ((result = vkQueueSubmit(graphics_queue, 1, &submit_info, VK_NULL_HANDLE)) != VK_SUCCESS) {
-            std::cerr << "Failed to submit initial buffer copy to graphics queue: " << string_VkResult(result) << "\n";
+            log_error() << "Failed to submit initial buffer copy to graphics queue: " << string_VkResult(result);
             return 1;
         }
-        // Wait for everything to complete.
-        vkQueueWaitIdle(graphics_queue);
-
-        vkFreeCommandBuffers(device, init_cmd_pool, 1, &cmd_buf);
-        vkDestroyCommandPool(device, init_cmd_pool, apiAllocCallbacks);
+        if (!options.timeline_semaphores) {
+            // Wait for everything to complete.
+            vkQueueWaitIdle(graphics_queue);
+        }
 
-        // Clean up staging buffers as well
-        vkDestroyBuffer(device, vb_staging, apiAllocCallbacks);
-        vkDestroyBuffer(device, ib_staging, apiAllocCallbacks);
-        vkFreeMemory(device, vb_staging_alloc, apiAllocCallbacks);
-        vkFreeMemory(device, ib_staging_alloc, apiAllocCallbacks);
+        // Clean up the command pool and staging buffers once it's done.
+        deferred_deletions.emplace_back(timeline_base, [=]() {
+            vkFreeCommandBuffers(device, init_cmd_pool, 1, &cmd_buf);
+            vkDestroyCommandPool(device, init_cmd_pool, apiAllocCallbacks);
+
+            vkDestroyBuffer(device, vb_staging, apiAllocCallbacks);
+            vkDestroyBuffer(device, ib_staging, apiAllocCallbacks);
+            vkFreeMemory(device, vb_staging_alloc, apiAllocCallbacks);
+            vkFreeMemory(device, ib_staging_alloc, apiAllocCallbacks);
+            vkDestroyBuffer(device, placeholder_staging, apiAllocCallbacks);
+            vkFreeMemory(device, placeholder_staging_alloc, apiAllocCallbacks);
+            vkDestroyBuffer(device, particle_staging, apiAllocCallbacks);
+            vkFreeMemory(device, particle_staging_alloc, apiAllocCallbacks);
+        });
     }
 
+    // Wakes the event loop when a texture level is ready to upload.
+    const Uint32 texture_loaded_event = SDL_RegisterEvents(1);
+    streamer.start([texture_loaded_event] {
+        SDL_Event event{};
+        event.type = texture_loaded_event;
+        SDL_PushEvent(&event);
+    });
+
 
     uint32_t image_index = 0;
 
+    // For regression checks: time to the first presented frame, and the
+    // average frame time once past the first few frames.
+    const uint64_t perf_warmup_frames = 10;
+    std::optional<double> startup_ms;
+    std::chrono::steady_clock::time_point perf_begin;
+
+    // Blocks until `frame` (counting from 0, and no more than
+    // max_frames_in_flight behind frame_count) has finished on the GPU.
+    // Returns whether we actually had to wait.
+    auto wait_for_frame = [&](uint64_t frame) {
+        TraceZone zone("Wait for frame", static_cast<int64_t>(frame));
+        const auto begin = std::chrono::steady_clock::now();
+        if (options.timeline_semaphores) {
+            const uint64_t value = timeline_base + frame + 1;
+            VkSemaphoreWaitInfo wait_info{
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+                .pNext = NULL,
+                .flags = 0,
+                .semaphoreCount = 1,
+                .pSemaphores = &frame_timeline,
+                .pValues = &value,
+            };
+            vkWaitSemaphores(device, &wait_info, std::numeric_limits<std::uint64_t>::max());
+        } else {
+            vkWaitForFences(device, 1, &in_flight_fence[frame % max_frames_in_flight], VK_TRUE, std::numeric_limits<std::uint64_t>::max());
+        }
+        // Anything much over the cost of the call means it blocked.
+        return std::chrono::steady_clock::now() - begin > std::chrono::microseconds(100);
+    };
+
+    // The last frame whose GPU timing came back, and when it started and
+    // ended on our clock, to see how much of the next frame's particle step
+    // overlapped it. Only known with calibrated timestamps.
+    uint64_t last_timed_frame = 0;
+    std::optional<std::pair<double, double>> last_timed_frame_ms;
+
+    // Reads back a finished frame's timestamps, once.
+    auto collect_frame_timing = [&](uint32_t slot) {
+        if (!timestamps_written[slot]) {
+            return;
+        }
+        timestamps_written[slot] = false;
+        frame_gpu_end_ms[slot].reset();
+        uint64_t timestamps[2];
+        if (vkGetQueryPoolResults(device, timestamp_pool, 2 * slot, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+            return;
+        }
+        const float gpu_ms = static_cast<float>(gpu_ticks_to_ms(timestamps[1] - timestamps[0]));
+        gpu_ms_total += gpu_ms;
+        ++gpu_frames;
+        if (options.dynamic_resolution) {
+            log_info() << "dynres: frame " << frame_index[slot] << " scale " << frame_scale[slot] << " gpu_ms " << gpu_ms;
+            resolution.update(gpu_ms);
+        }
+        limiter.frame_timed(gpu_ms);
+        frame_gpu_end_ms[slot] = gpu_ticks_to_ms(timestamps[1]);
+        last_timed_frame = frame_index[slot];
+        if (limiter.exact_offset) {
+            last_timed_frame_ms = {*frame_gpu_end_ms[slot] - gpu_ms + *limiter.offset_ms, *frame_gpu_end_ms[slot] + *limiter.offset_ms};
+        }
+        if (limiter.offset_ms && tracer.enabled) {
+            const double begin_ms = *frame_gpu_end_ms[slot] - gpu_ms;
+            tracer.gpu_zone("Frame", (begin_ms + *limiter.offset_ms) * 1e3, (*frame_gpu_end_ms[slot] + *limiter.offset_ms) * 1e3,
+                static_cast<int64_t>(frame_index[slot]));
+        }
+        if (limiter.offset_ms) {
+            const double latency_ms = *frame_gpu_end_ms[slot] + *limiter.offset_ms - frame_sample_ms[slot];
+            ++latency_frames;
+            latency_ms_total += latency_ms;
+            latency_ms_max = std::max(latency_ms_max, latency_ms);
+        }
+    };
+
+    // Same for the particle step. Overlap is only added up for the steps
+    // whose time on our clock is known, along with their GPU time.
+    std::vector<bool> particle_timestamps_written(max_frames_in_flight, false);
+    double particle_gpu_ms_total = 0.0, particle_overlap_ms_total = 0.0, particle_overlap_gpu_ms_total = 0.0;
+    uint64_t particle_steps_timed = 0;
+    double last_particle_step_ms = 0.0;
+    auto collect_particle_timing = [&](uint32_t slot) {
+        if (!particle_timestamps_written[slot]) {
+            return;
+        }
+        particle_timestamps_written[slot] = false;
+        uint64_t timestamps[2];
+        if (vkGetQueryPoolResults(device, compute_timestamp_pool, 2 * slot, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+            return;
+        }
+        const double step_ms = compute_ticks_to_ms(timestamps[1] - timestamps[0]);
+        particle_gpu_ms_total += step_ms;
+        ++particle_steps_timed;
+        if (!compute_offset_ms) {
+            return;
+        }
+        const double begin_ms = compute_ticks_to_ms(timestamps[0]) + *compute_offset_ms;
+        const double end_ms = begin_ms + step_ms;
+        // Only counts if the frame before was timed, which it will have been
+        // unless timestamps are off.
+        if (last_timed_frame_ms && last_timed_frame + 1 == frame_index[slot]) {
+            particle_overlap_ms_total += std::max(0.0, std::min(end_ms, last_timed_frame_ms->second) - std::max(begin_ms, last_timed_frame_ms->first));
+            particle_overlap_gpu_ms_total += step_ms;
+        }
+        if (tracer.enabled) {
+            tracer.gpu_zone("Particles", begin_ms * 1e3, end_ms * 1e3, static_cast<int64_t>(frame_index[slot]));
+        }
+    };
+
+    // Reads back a finished frame's pipeline statistics and overdraw counts,
+    // once. The frame is known to be done, so neither waits.
+    auto collect_frame_stats = [&](uint32_t slot) {
+        if (stats_written[slot]) {
+            stats_written[slot] = false;
+            std::vector<uint64_t> stats(n_stats);
+            if (vkGetQueryPoolResults(device, stats_pool, slot, 1, n_stats * sizeof(uint64_t), stats.data(), n_stats * sizeof(uint64_t),
+                    VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+                for (uint32_t i = 0; i != n_stats; ++i) {
+                    stats_total[i] += stats[i];
+                }
+                ++stats_frames;
+            }
+        }
+        if (slot < overdraw_targets.size() && overdraw_targets[slot].extent) {
+            OverdrawTarget &overdraw = overdraw_targets[slot];
+            const VkExtent2D extent = *overdraw.extent;
+            overdraw.extent.reset();
+            // Fragments per pixel would read the same for a window that's
+            // mostly empty and one with a small hot spot, so report the
+            // worst pixel too.
+            double fragments = 0.0;
+            float max_count = 0.0f;
+            const std::size_t pixels = static_cast<std::size_t>(extent.width) * extent.height;
+            for (std::size_t i = 0; i != pixels; ++i) {
+                const float count = half_to_float(overdraw.counts[i]);
+                fragments += count;
+                max_count = std::max(max_count, count);
+            }
+            const double per_pixel = fragments / pixels;
+            log_info() << "overdraw: frame " << frame_index[slot] << " fragments/pixel " << per_pixel << " max " << max_count;
+            ++overdraw_frames;
+            overdraw_total += per_pixel;
+            overdraw_max = std::max(overdraw_max, per_pixel);
+        }
+    };
+
+    // Render-on-demand bookkeeping. `redraw` is set by anything that could
+    // change what's on screen; while it's clear (or the window can't be
+    // seen) we block on events instead of rendering.
+    bool redraw = true;
+    double idle_seconds = 0.0;
+    double idle_cpu_seconds = 0.0;
+    // Set when an event wakes us from idle, cleared once the frame it
+    // caused has been presented.
+    std::optional<std::chrono::steady_clock::time_point> woken_at;
+    uint64_t wakes = 0;
+    double wake_latency_ms_total = 0.0;
+    double wake_latency_ms_max = 0.0;
+
+    // Clicking reports what's under the mouse. The ray from it goes straight
+    // into the screen, so in 2D it's just the point.
+    auto pick = [&](int x, int y) {
+        const auto begin = std::chrono::steady_clock::now();
+        int width = 0, height = 0;
+        SDL_GetWindowSize(window, &width, &height);
+        if (width == 0 || height == 0) {
+            return;
+        }
+        // Only kept fitted every frame when culling.
+        if (!options.cull) {
+            bvh.refit(object_bounds);
+        }
+        const float ndc_x = 2.0f * (x + 0.5f) / width - 1.0f, ndc_y = 2.0f * (y + 0.5f) / height - 1.0f;
+        const int64_t picked = bvh.pick(ndc_x, ndc_y, object_bounds, [&](uint32_t i) {
+            if (!simulation) {
+                return scene.contains(i, ndc_x, ndc_y);
+            }
+            return drawn_objects_slot && quad_contains(reinterpret_cast<const float *>(objects_mapped[*drawn_objects_slot] + i * object_stride),
+                Scene::half_extent, ndc_x, ndc_y);
+        });
+        const double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+        if (picked < 0) {
+            log_info() << "Picked nothing at (" << ndc_x << ", " << ndc_y << ") in " << us << "us";
+        } else {
+            log_info() << "Picked object " << picked << " (texture " << picked % n_textures << ") at (" << ndc_x << ", " << ndc_y << ") in " << us << "us";
+        }
+    };
+
+    if (options.tick_rate > 0.0f) {
+        simulation.emplace();
+        simulation->start(scene, options.tick_rate, scene_pool ? &*scene_pool : nullptr);
+    }
+
+    // Frame times while resizing every frame, and what the main thread spent
+    // logging meanwhile.
+    uint64_t storm_frames = 0, storm_recreations = 0, storm_log_lines = 0;
+    double storm_seconds = 0.0, storm_max_seconds = 0.0, storm_log_seconds = 0.0;
+    const Logger::ThreadStats log_stats_before_storm = Logger::thread_stats();
+    const uint64_t recreations_before_storm = swap_chain_recreations;
+
     // SDL event loop
     SDL_Event e;
     bool quit = false;
+    auto handle_event = [&](const SDL_Event &e) {
+        if (e.type == SDL_QUIT) {
+            log_info() << "Got SDL_QUIT";
+            quit = true;
+        } else if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_F12 && tracer.enabled) {
+            tracer.write(options.trace_path);
+        } else if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_l) {
+            lod_enabled = !lod_enabled;
+            if (!lod_enabled) {
+                std::fill(object_lods.begin(), object_lods.end(), 0);
+            }
+            log_info() << "LOD " << (lod_enabled ? "on" : "off");
+            redraw = true;
+        } else if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_v) {
+            // Round from most to least verbose.
+            logger.set_level(logger.level() == LogLevel::error ? LogLevel::debug : static_cast<LogLevel>(static_cast<int>(logger.level()) - 1));
+            // At the new level, so it's always shown.
+            LogLine(logger.level()) << "Log level " << log_level_name(logger.level());
+        } else if (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_LEFT) {
+            pick(e.button.x, e.button.y);
+        } else if (e.type != SDL_MOUSEMOTION) {
+            // Window exposed/resized/restored, input or a texture level
+            // arriving; be conservative and treat it all as a change.
+            redraw = true;
+        }
+    };
     while (!quit) {
-        while (SDL_PollEvent(&e)) {
-            if (e.type == SDL_QUIT) {
-                std::cout << "Got SDL_QUIT" << std::endl;
-                quit = true;
-                break;
+        // Nothing to render into when minimised, hidden or zero sized, and
+        // nothing new to show if the scene hasn't changed.
+        auto can_skip_frame = [&] {
+            int width = 0, height = 0;
+            SDL_Vulkan_GetDrawableSize(window, &width, &height);
+            const bool hidden = (SDL_GetWindowFlags(window) & (SDL_WINDOW_MINIMIZED | SDL_WINDOW_HIDDEN)) || width == 0 || height == 0;
+            return hidden || (options.on_demand && !redraw && !streamer.uploads_pending() && options.spin == 0.0f && options.particles == 0);
+        };
+        std::optional<std::chrono::steady_clock::time_point> wake_time;
+        if (can_skip_frame()) {
+            const auto idle_begin = std::chrono::steady_clock::now();
+            const std::clock_t idle_cpu_begin = std::clock();
+            // The timeout is just a backstop, anything that needs a frame
+            // sends an event.
+            TraceZone zone("Idle");
+            if (SDL_WaitEventTimeout(&e, 1000)) {
+                wake_time = std::chrono::steady_clock::now();
+                handle_event(e);
+            }
+            idle_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - idle_begin).count();
+            idle_cpu_seconds += static_cast<double>(std::clock() - idle_cpu_begin) / CLOCKS_PER_SEC;
+        }
+        if (options.low_latency && frame_count != 0) {
+            // Find out when the frame before last ended, so we can predict
+            // when the last one will.
+            const uint32_t previous_slot = (next_frame + max_frames_in_flight - 1) % max_frames_in_flight;
+            const uint32_t before_previous_slot = (next_frame + max_frames_in_flight - 2) % max_frames_in_flight;
+            std::optional<double> before_previous_end_ms;
+            if (frame_count >= 2) {
+                const bool blocked = wait_for_frame(frame_count - 2);
+                const double seen_ms = now_ms();
+                collect_frame_timing(before_previous_slot);
+                if (blocked && frame_gpu_end_ms[before_previous_slot]) {
+                    limiter.calibrate(seen_ms, *frame_gpu_end_ms[before_previous_slot]);
+                }
+                if (frame_gpu_end_ms[before_previous_slot] && limiter.offset_ms) {
+                    before_previous_end_ms = *frame_gpu_end_ms[before_previous_slot] + *limiter.offset_ms;
+                }
+            }
+            const double sample_at = limiter.next_sample_ms(frame_submit_ms[previous_slot], before_previous_end_ms, last_sample_ms);
+            const double wait_ms = sample_at - now_ms();
+            if (wait_ms > 0.0) {
+                TraceZone zone("Latency wait");
+                std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(wait_ms));
+            }
+        } else if (limiter.min_interval_ms > 0.0) {
+            const double wait_ms = last_sample_ms + limiter.min_interval_ms - now_ms();
+            if (wait_ms > 0.0) {
+                TraceZone zone("Frame cap wait");
+                std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(wait_ms));
             }
         }
+        // This is where input for the frame is sampled.
+        const double sample_ms = now_ms();
+        {
+            TraceZone zone("Poll events");
+            while (SDL_PollEvent(&e)) {
+                handle_event(e);
+                if (quit) {
+                    break;
+                }
+            }
+        }
+        if (quit) {
+            break;
+        }
+        if (can_skip_frame()) {
+            continue;
+        }
+        if (wake_time && !woken_at) {
+            woken_at = wake_time;
+        }
 
         // Note that we need to wait for the frame in question to no longer be in-flight
         // because it would be an error for us to reset the command buffer while the
         // GPU may still be/may be about to read from it.
-        vkWaitForFences(device, 1, &in_flight_fence[next_frame], VK_TRUE, std::numeric_limits<std::uint64_t>::max());
+        const uint64_t frame_value = timeline_base + frame_count + 1;
+        const uint64_t reuse_value = frame_value > max_frames_in_flight ? frame_value - max_frames_in_flight : 0;
+        const bool reuse_blocked = frame_count >= max_frames_in_flight && wait_for_frame(frame_count - max_frames_in_flight);
+        const double reuse_seen_ms = now_ms();
+
+        const auto sync_begin = std::chrono::steady_clock::now();
+        if (options.timeline_semaphores) {
+            // May well be further along than the frame we waited for.
+            vkGetSemaphoreCounterValue(device, frame_timeline, &completed_value);
+        } else {
+            // Frames complete in order, and we've waited on every one up to
+            // this slot's last.
+            completed_value = std::max(completed_value, reuse_value);
+        }
+        while (!deferred_deletions.empty() && deferred_deletions.front().first <= completed_value) {
+            deferred_deletions.front().second();
+            deferred_deletions.pop_front();
+        }
+        sync_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - sync_begin).count();
+
+        // Anything the driver allocated in this slot's COMMAND scope arena
+        // last time round is done with now.
+        if (host_allocator) {
+            host_allocator->begin_frame(frame_count, next_frame);
+        }
 
-        if ((result = vkAcquireNextImageKHR(device, swap_chain, UINT64_MAX, image_available_sem[next_frame], VK_NULL_HANDLE, &image_index)) != VK_SUCCESS) {
+        finish_capture(next_frame);
+
+        // The fence means this slot's timestamps from last time are ready.
+        if (frame_count % 64 == 0) {
+            calibrate_clocks();
+        }
+        // Particles first, while the frame before this slot's is still the
+        // last one timed.
+        collect_particle_timing(next_frame);
+        collect_frame_timing(next_frame);
+        collect_frame_stats(next_frame);
+        if (reuse_blocked && frame_gpu_end_ms[next_frame]) {
+            limiter.calibrate(reuse_seen_ms, *frame_gpu_end_ms[next_frame]);
+        }
+
+        if (frame_count < options.resize_storm) {
+            SDL_SetWindowSize(window, DEFAULT_WIDTH + static_cast<int>(frame_count % 2) * 64, DEFAULT_HEIGHT);
+        }
+
+        {
+            TraceZone zone("Acquire");
+            result = vkAcquireNextImageKHR(device, swap_chain, UINT64_MAX, image_available_sem[next_frame], VK_NULL_HANDLE, &image_index);
+        }
+        if (result != VK_SUCCESS) {
             if (result == VK_ERROR_OUT_OF_DATE_KHR) {
                 if (recreate_swap_chain()) {
                     return 1;
                 }
                 continue;
             } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
-                std::cerr << "Failed to acquire next swap chain image: " << string_VkResult(result) << "\n";
+                log_error() << "Failed to acquire next swap chain image: " << string_VkResult(result);
                 return 1;
             }
         }
 
-        vkResetFences(device, 1, &in_flight_fence[next_frame]);
+        if (!options.timeline_semaphores) {
+            const auto reset_begin = std::chrono::steady_clock::now();
+            vkResetFences(device, 1, &in_flight_fence[next_frame]);
+            sync_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - reset_begin).count();
+        }
         vkResetCommandBuffer(command_buffer[next_frame], 0);
 
+        const auto frame_cpu_begin = std::chrono::steady_clock::now();
+        // The buffer with the scene in, which is this one unless we're
+        // reusing a cached one.
+        VkCommandBuffer scene_cmd = command_buffer[next_frame];
         { // Record our command buffer!
+            TraceZone zone("Record", static_cast<int64_t>(frame_count));
             VkCommandBufferBeginInfo begin_info{
                 .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
                 .pNext = NULL,
@@ -1012,79 +6950,705 @@ int main(int argc, char** argv) {
                 .pInheritanceInfo = NULL,
             };
             if ((result = vkBeginCommandBuffer(command_buffer[next_frame], &begin_info)) != VK_SUCCESS) {
-                std::cerr << "Failed to begin command buffer: " << string_VkResult(result) << "\n";
+                log_error() << "Failed to begin command buffer: " << string_VkResult(result);
                 return 1;
             }
 
-            VkClearValue clear_color = {{{
-                0.0f, 0.0f, 0.0f, 1.0f
-            }}};
-            VkRenderPassBeginInfo render_pass_info{
-                .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-                .renderPass = render_pass,
-                .framebuffer = swap_framebuffers[image_index],
-                .renderArea = {
+            if (timestamp_pool != VK_NULL_HANDLE) {
+                vkCmdResetQueryPool(command_buffer[next_frame], timestamp_pool, 2 * next_frame, 2);
+                vkCmdWriteTimestamp(command_buffer[next_frame], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestamp_pool, 2 * next_frame);
+            }
+            if (stats_pool != VK_NULL_HANDLE) {
+                vkCmdResetQueryPool(command_buffer[next_frame], stats_pool, next_frame, 1);
+            }
+
+            // With dynamic resolution we render into this frame's offscreen
+            // target at the scaled size, and blit it to the swap image after.
+            const VkExtent2D render_extent = options.dynamic_resolution ? resolution.scaled(swap_chain_extent) : swap_chain_extent;
+            frame_scale[next_frame] = options.dynamic_resolution ? resolution.scale : 1.0f;
+            frame_index[next_frame] = frame_count;
+
+            // The slot's object buffer is free now its last frame is done.
+            {
+                TraceZone zone("Scene update");
+                const auto update_begin = std::chrono::steady_clock::now();
+                if (simulation) {
+                    // Take the latest tick, keeping the one before.
+                    if (simulation->snapshots.update()) {
+                        std::swap(sim_previous, sim_current);
+                        std::swap(sim_current, simulation->snapshots.front());
+                    }
+                    // A tick behind, so there's normally a tick either side.
+                    const double render_time = simulation->now() - simulation->tick_seconds();
+                    const double span = sim_current.time - sim_previous.time;
+                    const float alpha = span > 0.0 ? static_cast<float>(std::clamp((render_time - sim_previous.time) / span, 0.0, 1.0)) : 1.0f;
+                    Simulation::interpolate(sim_previous, sim_current, alpha, objects_mapped[next_frame], object_stride, object_bounds.data(),
+                        scene_pool ? &*scene_pool : nullptr);
+                    drawn_objects_slot = next_frame;
+                } else {
+                    const float time = std::chrono::duration<float>(update_begin - scene_begin).count();
+                    scene.update(time, objects_mapped[next_frame], object_stride, object_bounds.data(), scene_pool ? &*scene_pool : nullptr);
+                }
+                scene_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - update_begin).count();
+            }
+            if (options.cull) {
+                TraceZone zone("Cull");
+                const auto refit_begin = std::chrono::steady_clock::now();
+                bvh.refit(object_bounds);
+                const auto cull_begin = std::chrono::steady_clock::now();
+                bvh.cull(Frustum::ndc(), object_bounds, visible);
+                const auto cull_end = std::chrono::steady_clock::now();
+                refit_seconds += std::chrono::duration<double>(cull_begin - refit_begin).count();
+                cull_seconds += std::chrono::duration<double>(cull_end - cull_begin).count();
+                objects_culled += n_objects - visible.size();
+                // A scene recorded with different objects visible is stale.
+                if (visible != slot_visible[next_frame]) {
+                    slot_visible[next_frame] = visible;
+                    ++slot_versions[next_frame];
+                }
+            }
+            if (lod_enabled) {
+                TraceZone zone("LOD selection");
+                for (const uint32_t i : visible) {
+                    // The mesh is a unit across, so this is pixels per unit.
+                    const Aabb &b = object_bounds[i];
+                    const float pixels = std::max((b.max_x - b.min_x) * 0.5f * render_extent.width, (b.max_y - b.min_y) * 0.5f * render_extent.height);
+                    object_lods[i] = select_lod(mesh_lods, pixels, object_lods[i], options.lod_error);
+                }
+            }
+            frame_triangles = 0;
+            for (const uint32_t i : visible) {
+                frame_triangles += mesh_lods[object_lods[i]].index_count / 3;
+            }
+            if (object_lods != slot_lods[next_frame]) {
+                slot_lods[next_frame] = object_lods;
+                ++slot_versions[next_frame];
+            }
+
+            // Each quad covers object_scale of half the render target. With a
+            // single draw only the first texture is drawn; the rest just sit
+            // at whatever they've loaded.
+            for (uint32_t t = 0; t != std::min(n_objects, n_textures); ++t) {
+                streamer.mark_used(t, 0.5f * object_scale * render_extent.width, frame_count);
+            }
+            {
+                TraceZone zone("Texture uploads");
+                if (!streamer.update(command_buffer[next_frame], next_frame, frame_count, frame_deletions)) {
+                    return 1;
+                }
+            }
+            for (auto &deletion : frame_deletions) {
+                deferred_deletions.emplace_back(frame_value, std::move(deletion));
+            }
+            frame_deletions.clear();
+            std::vector<VkDescriptorImageInfo> texture_infos;
+            std::vector<VkWriteDescriptorSet> texture_writes;
+            texture_infos.reserve(n_textures);
+            for (uint32_t t = 0; t != n_textures; ++t) {
+                const VkImageView view = streamer.texture(t).view != VK_NULL_HANDLE ? streamer.texture(t).view : placeholder_view;
+                VkImageView &bound = bound_views[next_frame * n_textures + t];
+                if (bound == view) {
+                    continue;
+                }
+                bound = view;
+                texture_infos.push_back({
+                    .sampler = sampler,
+                    .imageView = view,
+                    .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                });
+                texture_writes.push_back({
+                    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                    .pNext = NULL,
+                    .dstSet = descriptor_sets[next_frame * sets_per_frame + (options.bindless ? 0 : t)],
+                    .dstBinding = 0,
+                    .dstArrayElement = options.bindless ? t : 0,
+                    .descriptorCount = 1,
+                    .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                    .pImageInfo = &texture_infos.back(),
+                    .pBufferInfo = NULL,
+                    .pTexelBufferView = NULL,
+                });
+            }
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(texture_writes.size()), texture_writes.data(), 0, NULL);
+            // Updating a set invalidates command buffers that bound it,
+            // unless it's update-after-bind like the bindless table.
+            if (!options.bindless && !texture_writes.empty()) {
+                ++slot_versions[next_frame];
+            }
+
+            // Everything from here to the end of the blit only depends on
+            // this frame slot, the swap image, the render scale and which
+            // descriptors are bound, so it can be recorded once and
+            // resubmitted until one of those changes.
+            auto record_scene = [&](VkCommandBuffer cmd) {
+                VkClearValue clear_color = {{{
+                    0.0f, 0.0f, 0.0f, 1.0f
+                }}};
+                VkRenderPassBeginInfo render_pass_info{
+                    .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+                    .renderPass = options.dynamic_resolution ? scaled_render_pass : render_pass,
+                    .framebuffer = options.dynamic_resolution ? scaled_targets[next_frame].framebuffer : swap_framebuffers[image_index],
+                    .renderArea = {
+                        .offset = {0, 0},
+                        .extent = render_extent,
+                    },
+                    .clearValueCount = 1,
+                    .pClearValues = &clear_color,
+                };
+
+                // Without render pass objects the layout transitions they
+                // made are ours to do. Everything rendered to is cleared, so
+                // old contents are discarded, but we still have to wait for
+                // whatever last read the image: the presentation engine
+                // (covered by the acquire semaphore's wait stage) or, for the
+                // offscreen targets, the previous frame's blit or copy.
+                auto begin_rendering = [&](VkImage image, VkImageView view, VkPipelineStageFlags src_stages, const VkClearValue &clear) {
+                    VkImageMemoryBarrier to_attachment{
+                        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                        .pNext = NULL,
+                        .srcAccessMask = 0,
+                        .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+                        .newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                        .image = image,
+                        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+                    };
+                    vkCmdPipelineBarrier(cmd, src_stages, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0,
+                        0, NULL, 0, NULL, 1, &to_attachment);
+
+                    VkRenderingAttachmentInfo attachment{
+                        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+                        .pNext = NULL,
+                        .imageView = view,
+                        .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                        .resolveMode = VK_RESOLVE_MODE_NONE,
+                        .resolveImageView = VK_NULL_HANDLE,
+                        .resolveImageLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+                        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+                        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+                        .clearValue = clear,
+                    };
+                    VkRenderingInfo rendering_info{
+                        .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+                        .pNext = NULL,
+                        .flags = 0,
+                        .renderArea = render_pass_info.renderArea,
+                        .layerCount = 1,
+                        .viewMask = 0,
+                        .colorAttachmentCount = 1,
+                        .pColorAttachments = &attachment,
+                        .pDepthAttachment = NULL,
+                        .pStencilAttachment = NULL,
+                    };
+                    cmd_begin_rendering(cmd, &rendering_info);
+                };
+                // Then leave the image ready to present, or to be blitted or
+                // copied from.
+                auto end_rendering = [&](VkImage image, VkImageLayout layout) {
+                    cmd_end_rendering(cmd);
+                    const bool present = layout == VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+                    VkImageMemoryBarrier from_attachment{
+                        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                        .pNext = NULL,
+                        .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                        .dstAccessMask = present ? VkAccessFlags{0} : VkAccessFlags{VK_ACCESS_TRANSFER_READ_BIT},
+                        .oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                        .newLayout = layout,
+                        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                        .image = image,
+                        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+                    };
+                    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                        present ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                        0, NULL, 0, NULL, 1, &from_attachment);
+                };
+                const VkImage scene_image = options.dynamic_resolution ? scaled_targets[next_frame].image : swap_images[image_index];
+
+                if (stats_pool != VK_NULL_HANDLE) {
+                    vkCmdBeginQuery(cmd, stats_pool, next_frame, 0);
+                }
+
+                // Recording the render pass in the command buffer.
+                if (options.dynamic_rendering && options.dynamic_resolution) {
+                    begin_rendering(scene_image, scaled_targets[next_frame].view,
+                        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, clear_color);
+                } else if (options.dynamic_rendering) {
+                    begin_rendering(scene_image, swap_image_views[image_index], VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, clear_color);
+                } else {
+                    vkCmdBeginRenderPass(cmd, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
+                }
+                vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_pipeline);
+
+                VkViewport viewport{
+                    .x = 0.0f,
+                    .y = 0.0f,
+                    .width = (float) render_extent.width,
+                    .height = (float) render_extent.height,
+                    .minDepth = 0.0f,
+                    .maxDepth = 1.0f,
+                };
+                vkCmdSetViewport(cmd, 0, 1, &viewport);
+
+                VkRect2D scissor{
                     .offset = {0, 0},
-                    .extent = swap_chain_extent,
-                },
-                .clearValueCount = 1,
-                .pClearValues = &clear_color,
-            };
+                    .extent = render_extent,
+                };
+                vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+                VkDeviceSize offsets[] = { 0 };
+                vkCmdBindVertexBuffers(cmd, 0, 1, &vb, offsets);
+
+                vkCmdBindIndexBuffer(cmd, ib, 0, VK_INDEX_TYPE_UINT16);
+
+                // Also used again for the overdraw pass, whose pipeline shares
+                // the layout.
+                auto record_draws = [&] {
+                    if (options.bindless) {
+                        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1,
+                            &descriptor_sets[next_frame], 0, NULL);
+                    }
+                    for (const uint32_t i : visible) {
+                        const uint32_t t = i % n_textures;
+                        if (options.bindless) {
+                            DrawConstants constants{
+                                .texture = t,
+                                .buffer = 0,
+                                .object = i,
+                            };
+                            vkCmdPushConstants(cmd, pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+                                0, sizeof(constants), &constants);
+                        } else {
+                            const uint32_t dynamic_offset = static_cast<uint32_t>(i * object_stride);
+                            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1,
+                                &descriptor_sets[next_frame * sets_per_frame + t], 1, &dynamic_offset);
+                        }
+                        const MeshLod &lod = mesh_lods[object_lods[i]];
+                        vkCmdDrawIndexed(cmd, lod.index_count, 1, lod.first_index, 0, 0);
+                    }
+                };
+                const auto record_begin = std::chrono::steady_clock::now();
+                record_draws();
+                record_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - record_begin).count();
+                draws_recorded += visible.size();
+
+                // Particles over the top, a few pixels across, straight from
+                // the buffer this frame's compute step wrote.
+                if (n_particles != 0) {
+                    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, particle_pipeline);
+                    const float sprite_size[2] = {3.0f / render_extent.width, 3.0f / render_extent.height};
+                    vkCmdPushConstants(cmd, particle_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(sprite_size), sprite_size);
+                    vkCmdBindVertexBuffers(cmd, 0, 1, &particle_buffers[next_frame], offsets);
+                    vkCmdDraw(cmd, 6, n_particles, 0, 0);
+                    // The overdraw pass wants the mesh back.
+                    vkCmdBindVertexBuffers(cmd, 0, 1, &vb, offsets);
+                }
+            
+                if (options.dynamic_rendering) {
+                    end_rendering(scene_image, options.dynamic_resolution ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+                } else {
+                    vkCmdEndRenderPass(cmd);
+                }
+                if (stats_pool != VK_NULL_HANDLE) {
+                    vkCmdEndQuery(cmd, stats_pool, next_frame);
+                }
 
-            // Recording the render pass in the command buffer.
-            vkCmdBeginRenderPass(command_buffer[next_frame], &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
-            vkCmdBindPipeline(command_buffer[next_frame], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics_pipeline);
-
-            VkViewport viewport{
-                .x = 0.0f,
-                .y = 0.0f,
-                .width = (float) swap_chain_extent.width,
-                .height = (float) swap_chain_extent.height,
-                .minDepth = 0.0f,
-                .maxDepth = 1.0f,
-            };
-            vkCmdSetViewport(command_buffer[next_frame], 0, 1, &viewport);
+                if (timestamp_pool != VK_NULL_HANDLE) {
+                    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestamp_pool, 2 * next_frame + 1);
+                }
+
+                // Outside the timestamps, so it doesn't count towards GPU frame
+                // time or upset dynamic resolution.
+                if (options.overdraw) {
+                    OverdrawTarget &overdraw = overdraw_targets[next_frame];
+                    VkClearValue clear_zero = {{{0.0f, 0.0f, 0.0f, 0.0f}}};
+                    VkRenderPassBeginInfo overdraw_pass_info = render_pass_info;
+                    overdraw_pass_info.renderPass = overdraw_render_pass;
+                    overdraw_pass_info.framebuffer = overdraw.target.framebuffer;
+                    overdraw_pass_info.pClearValues = &clear_zero;
+                    if (options.dynamic_rendering) {
+                        begin_rendering(overdraw.target.image, overdraw.target.view,
+                            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, clear_zero);
+                    } else {
+                        vkCmdBeginRenderPass(cmd, &overdraw_pass_info, VK_SUBPASS_CONTENTS_INLINE);
+                    }
+                    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, overdraw_pipeline);
+                    record_draws();
+                    if (options.dynamic_rendering) {
+                        end_rendering(overdraw.target.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+                    } else {
+                        vkCmdEndRenderPass(cmd);
+                    }
+
+                    // Copy out just the part we rendered to, tightly packed.
+                    VkBufferImageCopy region{
+                        .bufferOffset = 0,
+                        .bufferRowLength = 0,
+                        .bufferImageHeight = 0,
+                        .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+                        .imageOffset = {0, 0, 0},
+                        .imageExtent = {render_extent.width, render_extent.height, 1},
+                    };
+                    vkCmdCopyImageToBuffer(cmd, overdraw.target.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                        overdraw.readback, 1, &region);
+                    VkBufferMemoryBarrier to_host{
+                        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+                        .pNext = NULL,
+                        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+                        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                        .buffer = overdraw.readback,
+                        .offset = 0,
+                        .size = VK_WHOLE_SIZE,
+                    };
+                    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+                        0, NULL, 1, &to_host, 0, NULL);
+                }
 
-            VkRect2D scissor{
-                .offset = {0, 0},
-                .extent = swap_chain_extent,
+                if (options.dynamic_resolution) {
+                    // The scaled target was left in TRANSFER_SRC by the render
+                    // pass or end_rendering. The swap image's old contents are irrelevant as we
+                    // overwrite all of it.
+                    VkImageMemoryBarrier to_transfer_dst{
+                        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                        .pNext = NULL,
+                        .srcAccessMask = 0,
+                        .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+                        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                        .image = swap_images[image_index],
+                        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+                    };
+                    // The source stage matches the stage the acquire semaphore is
+                    // waited on at in the submit below.
+                    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                        0, NULL, 0, NULL, 1, &to_transfer_dst);
+
+                    VkImageBlit blit{
+                        .srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+                        .srcOffsets = {{0, 0, 0}, {static_cast<int32_t>(render_extent.width), static_cast<int32_t>(render_extent.height), 1}},
+                        .dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+                        .dstOffsets = {{0, 0, 0}, {static_cast<int32_t>(swap_chain_extent.width), static_cast<int32_t>(swap_chain_extent.height), 1}},
+                    };
+                    vkCmdBlitImage(cmd,
+                        scaled_targets[next_frame].image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                        swap_images[image_index], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                        1, &blit, blit_filter);
+
+                    VkImageMemoryBarrier to_present{
+                        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                        .pNext = NULL,
+                        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                        .dstAccessMask = 0,
+                        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                        .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                        .image = swap_images[image_index],
+                        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+                    };
+                    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                        0, NULL, 0, NULL, 1, &to_present);
+                }
             };
-            vkCmdSetScissor(command_buffer[next_frame], 0, 1, &scissor);
 
-            VkDeviceSize offsets[] = { 0 };
-            vkCmdBindVertexBuffers(command_buffer[next_frame], 0, 1, &vb, offsets);
+            if (options.reuse_commands && !capturing) {
+                const std::size_t key = next_frame * swap_images.size() + image_index;
+                if (cached_commands.size() < max_frames_in_flight * swap_images.size()) {
+                    cached_commands.resize(max_frames_in_flight * swap_images.size());
+                }
+                CachedCommands &cached = cached_commands[key];
+                if (cached.cmd == VK_NULL_HANDLE) {
+                    VkCommandBufferAllocateInfo alloc_info{
+                        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                        .pNext = NULL,
+                        .commandPool = command_pool,
+                        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                        .commandBufferCount = 1,
+                    };
+                    if ((result = vkAllocateCommandBuffers(device, &alloc_info, &cached.cmd)) != VK_SUCCESS) {
+                        log_error() << "Failed to allocate cached command buffer: " << string_VkResult(result);
+                        return 1;
+                    }
+                }
+                // The slot's last use of this buffer finished before we got
+                // past its fence, so it's never pending here.
+                if (cached.version != slot_versions[next_frame] || cached.swap_chain_generation != swap_chain_generation ||
+                    cached.scale != frame_scale[next_frame]) {
+                    if ((result = vkBeginCommandBuffer(cached.cmd, &begin_info)) != VK_SUCCESS) {
+                        log_error() << "Failed to begin cached command buffer: " << string_VkResult(result);
+                        return 1;
+                    }
+                    record_scene(cached.cmd);
+                    if ((result = vkEndCommandBuffer(cached.cmd)) != VK_SUCCESS) {
+                        log_error() << "Failed to record cached command buffer: " << string_VkResult(result);
+                        return 1;
+                    }
+                    cached.version = slot_versions[next_frame];
+                    cached.swap_chain_generation = swap_chain_generation;
+                    cached.scale = frame_scale[next_frame];
+                    ++commands_recorded;
+                } else {
+                    ++commands_reused;
+                }
+                scene_cmd = cached.cmd;
+            } else {
+                record_scene(command_buffer[next_frame]);
+                ++commands_recorded;
+            }
+            timestamps_written[next_frame] = timestamp_pool != VK_NULL_HANDLE;
+            stats_written[next_frame] = stats_pool != VK_NULL_HANDLE;
+            if (options.overdraw) {
+                overdraw_targets[next_frame].extent = render_extent;
+            }
 
-            vkCmdBindIndexBuffer(command_buffer[next_frame], ib, 0, VK_INDEX_TYPE_UINT16);
+            if (capturing) {
+                // Find a slot the writer has finished with. If there isn't
+                // one the writer is behind and we drop this frame rather
+                // than wait for it.
+                CaptureSlot *slot = nullptr;
+                for (auto &candidate : capture_slots) {
+                    if (!candidate.busy.load(std::memory_order_acquire)) {
+                        slot = &candidate;
+                        break;
+                    }
+                }
+                const VkDeviceSize bytes = static_cast<VkDeviceSize>(swap_chain_extent.width) * swap_chain_extent.height * 4;
+                if (slot && slot->capacity < bytes) {
+                    // First use, or the window got bigger.
+                    destroy_capture_slot(*slot);
+                    if (!create_buffer(slot->buffer, slot->memory, device, apiAllocCallbacks, device_memory_props, static_cast<uint32_t>(bytes), VK_BUFFER_USAGE_TRANSFER_DST_BIT, capture_memory_flags)) {
+                        return 1;
+                    }
+                    void *ptr = nullptr;
+                    if ((result = vkMapMemory(device, slot->memory, 0, VK_WHOLE_SIZE, 0, &ptr)) != VK_SUCCESS) {
+                        log_error() << "Failed to map capture buffer: " << string_VkResult(result);
+                        return 1;
+                    }
+                    slot->mapped = static_cast<uint8_t *>(ptr);
+                    slot->capacity = bytes;
+                }
 
-            // Draw 3 vertices!
-            vkCmdDrawIndexed(command_buffer[next_frame], n_indices, 1, 0, 0, 0);
-            
-            vkCmdEndRenderPass(command_buffer[next_frame]);
+                if (slot) {
+                    slot->busy.store(true, std::memory_order_relaxed);
+                    slot->extent = swap_chain_extent;
+                    slot->bgra = capture_bgra;
+                    slot->frame = frame_count;
+                    capture_pending[next_frame] = slot;
+                    ++captured_frames;
+                    readback_bytes += bytes;
+
+                    // Whichever path we took, the swap image is in
+                    // PRESENT_SRC now, written either by the render pass or
+                    // the blit.
+                    VkImageMemoryBarrier to_transfer_src{
+                        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                        .pNext = NULL,
+                        .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+                        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+                        .oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                        .image = swap_images[image_index],
+                        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+                    };
+                    vkCmdPipelineBarrier(command_buffer[next_frame],
+                        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                        0, NULL, 0, NULL, 1, &to_transfer_src);
+
+                    VkBufferImageCopy region{
+                        .bufferOffset = 0,
+                        .bufferRowLength = 0,
+                        .bufferImageHeight = 0,
+                        .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+                        .imageOffset = {0, 0, 0},
+                        .imageExtent = {swap_chain_extent.width, swap_chain_extent.height, 1},
+                    };
+                    vkCmdCopyImageToBuffer(command_buffer[next_frame], swap_images[image_index], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot->buffer, 1, &region);
+
+                    VkImageMemoryBarrier back_to_present = to_transfer_src;
+                    back_to_present.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+                    back_to_present.dstAccessMask = 0;
+                    back_to_present.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+                    back_to_present.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+                    // Make the copy visible to the host once the fence signals.
+                    VkBufferMemoryBarrier to_host{
+                        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+                        .pNext = NULL,
+                        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                        .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+                        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                        .buffer = slot->buffer,
+                        .offset = 0,
+                        .size = VK_WHOLE_SIZE,
+                    };
+                    vkCmdPipelineBarrier(command_buffer[next_frame],
+                        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0,
+                        0, NULL, 1, &to_host, 1, &back_to_present);
+                } else {
+                    ++dropped_frames;
+                }
+            }
 
             if ((result = vkEndCommandBuffer(command_buffer[next_frame])) != VK_SUCCESS) {
-                std::cerr << "Failed to successfully record command buffer: " << string_VkResult(result) << "\n";
+                log_error() << "Failed to successfully record command buffer: " << string_VkResult(result);
                 return 1;
             }
 
         }
 
 
-        VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+        // Step the particles for this frame. This goes to the compute queue
+        // ahead of the graphics, which only waits for it at vertex input, so
+        // it can run alongside the end of the last frame's rendering. The
+        // slot's buffer and command buffer are free: its last frame's
+        // graphics, which waited on its last step, is done.
+        if (n_particles != 0) {
+            TraceZone zone("Particles", static_cast<int64_t>(frame_count));
+            const VkCommandBuffer cmd = compute_cmds[next_frame];
+            vkResetCommandBuffer(cmd, 0);
+            VkCommandBufferBeginInfo begin_info{
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+                .pNext = NULL,
+                .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+                .pInheritanceInfo = NULL,
+            };
+            if ((result = vkBeginCommandBuffer(cmd, &begin_info)) != VK_SUCCESS) {
+                log_error() << "Failed to begin compute command buffer: " << string_VkResult(result);
+                return 1;
+            }
+            if (compute_timestamp_pool != VK_NULL_HANDLE) {
+                vkCmdResetQueryPool(cmd, compute_timestamp_pool, 2 * next_frame, 2);
+                vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, compute_timestamp_pool, 2 * next_frame);
+            }
+            // The last step, on this same queue, wrote what this one reads.
+            VkMemoryBarrier last_step{
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .pNext = NULL,
+                .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+            };
+            vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                1, &last_step, 0, NULL, 0, NULL);
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, compute_pipeline);
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, compute_layout, 0, 1, &particle_sets[next_frame], 0, NULL);
+            // Big gaps between frames, like after sitting idle, would throw
+            // everything through the floor.
+            ParticleStep step{
+                .dt = frame_count == 0 ? 0.0f : static_cast<float>(std::min((sample_ms - last_particle_step_ms) / 1e3, 0.05)),
+                .time = std::chrono::duration<float>(std::chrono::steady_clock::now() - scene_begin).count(),
+                .count = n_particles,
+            };
+            last_particle_step_ms = sample_ms;
+            vkCmdPushConstants(cmd, compute_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(step), &step);
+            vkCmdDispatch(cmd, (n_particles + 255) / 256, 1, 1);
+            if (compute_timestamp_pool != VK_NULL_HANDLE) {
+                vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, compute_timestamp_pool, 2 * next_frame + 1);
+            }
+            if ((result = vkEndCommandBuffer(cmd)) != VK_SUCCESS) {
+                log_error() << "Failed to successfully record compute command buffer: " << string_VkResult(result);
+                return 1;
+            }
+
+            // The first step reads the initial upload, which with a timeline
+            // we haven't waited for.
+            const VkPipelineStageFlags upload_stage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+            const bool wait_upload = options.timeline_semaphores && frame_count == 0;
+            VkTimelineSemaphoreSubmitInfo compute_timeline{
+                .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+                .pNext = NULL,
+                .waitSemaphoreValueCount = 1,
+                .pWaitSemaphoreValues = &timeline_base,
+                .signalSemaphoreValueCount = 0,
+                .pSignalSemaphoreValues = NULL,
+            };
+            VkSubmitInfo compute_submit{
+                .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                .pNext = wait_upload ? &compute_timeline : NULL,
+                .waitSemaphoreCount = wait_upload ? 1u : 0u,
+                .pWaitSemaphores = &frame_timeline,
+                .pWaitDstStageMask = &upload_stage,
+                .commandBufferCount = 1,
+                .pCommandBuffers = &cmd,
+                .signalSemaphoreCount = 1,
+                .pSignalSemaphores = &particles_ready_sem[next_frame],
+            };
+            if ((result = vkQueueSubmit(compute_queue, 1, &compute_submit, VK_NULL_HANDLE)) != VK_SUCCESS) {
+                log_error() << "Failed to submit to compute queue: " << string_VkResult(result);
+                return 1;
+            }
+            particle_timestamps_written[next_frame] = compute_timestamp_pool != VK_NULL_HANDLE;
+        }
+
+        // Acquire and present still need binary semaphores. With a timeline
+        // the first frame also waits for the initial upload, and every frame
+        // signals its value on the timeline instead of a fence. Particles
+        // are only needed once we get to drawing them.
+        VkPipelineStageFlags wait_stages[3] = {
+            // With dynamic resolution the swap image is first touched by the blit.
+            options.dynamic_resolution ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        };
+        VkSemaphore wait_sems[3] = {image_available_sem[next_frame]};
+        // Values for binary semaphores are ignored.
+        uint64_t wait_values[3] = {0};
+        uint32_t wait_count = 1;
+        if (options.timeline_semaphores && frame_count == 0) {
+            wait_stages[wait_count] = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+            wait_sems[wait_count] = frame_timeline;
+            wait_values[wait_count++] = timeline_base;
+        }
+        if (n_particles != 0) {
+            wait_stages[wait_count] = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+            wait_sems[wait_count] = particles_ready_sem[next_frame];
+            wait_values[wait_count++] = 0;
+        }
+        VkSemaphore signal_sems[] = {render_finished_sem[next_frame], frame_timeline};
+        const uint64_t signal_values[] = {0, frame_value};
+        const uint32_t signal_count = options.timeline_semaphores ? 2 : 1;
+        VkTimelineSemaphoreSubmitInfo timeline_submit{
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .pNext = NULL,
+            .waitSemaphoreValueCount = wait_count,
+            .pWaitSemaphoreValues = wait_values,
+            .signalSemaphoreValueCount = signal_count,
+            .pSignalSemaphoreValues = signal_values,
+        };
+        // Per-frame work first, then the scene if it's separate.
+        VkCommandBuffer submit_cmds[] = {command_buffer[next_frame], scene_cmd};
         VkSubmitInfo submit_info{
             .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-            .waitSemaphoreCount = 1,
-            .pWaitSemaphores = &image_available_sem[next_frame],
+            .pNext = options.timeline_semaphores ? &timeline_submit : NULL,
+            .waitSemaphoreCount = wait_count,
+            .pWaitSemaphores = wait_sems,
             .pWaitDstStageMask = wait_stages,
-            .commandBufferCount = 1,
-            .pCommandBuffers = &command_buffer[next_frame],
-            .signalSemaphoreCount = 1,
-            .pSignalSemaphores = &render_finished_sem[next_frame],
+            .commandBufferCount = scene_cmd != command_buffer[next_frame] ? 2u : 1u,
+            .pCommandBuffers = submit_cmds,
+            .signalSemaphoreCount = signal_count,
+            .pSignalSemaphores = signal_sems,
         };
 
-        if ((result = vkQueueSubmit(graphics_queue, 1, &submit_info, in_flight_fence[next_frame])) != VK_SUCCESS) {
-            std::cerr << "Failed to submit to queue: " << string_VkResult(result) << "\n";
+        const auto submit_begin = std::chrono::steady_clock::now();
+        {
+            TraceZone zone("Submit");
+            result = vkQueueSubmit(graphics_queue, 1, &submit_info, in_flight_fence[next_frame]);
+        }
+        if (result != VK_SUCCESS) {
+            log_error() << "Failed to submit to queue: " << string_VkResult(result);
             return 1;
         }
+        frame_cpu_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - frame_cpu_begin).count();
+        sync_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - submit_begin).count();
+        frame_sample_ms[next_frame] = sample_ms;
+        frame_submit_ms[next_frame] = now_ms();
+        last_sample_ms = sample_ms;
+        limiter.frame_submitted(frame_submit_ms[next_frame] - sample_ms);
 
         VkPresentInfoKHR present_info{
             .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
@@ -1096,26 +7660,340 @@ int main(int argc, char** argv) {
             .pResults = NULL,
         };
 
-        if ((result = vkQueuePresentKHR(present_queue, &present_info)) != VK_SUCCESS) {
+        {
+            TraceZone zone("Present");
+            result = vkQueuePresentKHR(present_queue, &present_info);
+        }
+        if (result != VK_SUCCESS) {
             if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
                 if (recreate_swap_chain()) {
                     return 1;
                 }
             } else {
-                std::cerr << "Failed to present: " << string_VkResult(result) << "\n";
+                log_error() << "Failed to present: " << string_VkResult(result);
                 return 1;
             }
         }
 
+        if (!startup_ms) {
+            startup_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startup_begin).count();
+        }
+        // Frame to frame, except after idling, which would count the idle.
+        const auto frame_end = std::chrono::steady_clock::now();
+        if (last_frame_end && !woken_at && frame_count >= perf_warmup_frames) {
+            lod_frame_seconds[lod_enabled] += std::chrono::duration<double>(frame_end - *last_frame_end).count();
+            lod_triangles[lod_enabled] += frame_triangles;
+            ++lod_frames[lod_enabled];
+        }
+        if (frame_count < options.resize_storm) {
+            if (last_frame_end) {
+                const double seconds = std::chrono::duration<double>(frame_end - *last_frame_end).count();
+                ++storm_frames;
+                storm_seconds += seconds;
+                storm_max_seconds = std::max(storm_max_seconds, seconds);
+            }
+            if (frame_count + 1 == options.resize_storm) {
+                const Logger::ThreadStats &log_stats = Logger::thread_stats();
+                storm_log_lines = log_stats.lines - log_stats_before_storm.lines;
+                storm_log_seconds = log_stats.seconds - log_stats_before_storm.seconds;
+                storm_recreations = swap_chain_recreations - recreations_before_storm;
+            }
+        }
+        last_frame_end = frame_end;
+        redraw = false;
+        if (woken_at) {
+            const double latency_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - *woken_at).count();
+            ++wakes;
+            wake_latency_ms_total += latency_ms;
+            wake_latency_ms_max = std::max(wake_latency_ms_max, latency_ms);
+            woken_at.reset();
+        }
+
         next_frame = (next_frame + 1) % max_frames_in_flight;
+        ++frame_count;
+        if (frame_count == perf_warmup_frames) {
+            perf_begin = std::chrono::steady_clock::now();
+        }
+        if (options.max_frames != 0 && frame_count >= options.max_frames) {
+            quit = true;
+        }
     }
 
-    std::cout << "Exiting...\n";
+    log_info() << "Exiting...";
 
     vkDeviceWaitIdle(device);
+    // Everything logged is out before the reports.
+    logger.stop();
+
+    // Non-zero if a regression check fails.
+    int exit_code = 0;
+    const auto perf_end = std::chrono::steady_clock::now();
+
+    if (!options.capture_path.empty() || !options.compare_path.empty()) {
+        for (std::size_t i = 0; i != max_frames_in_flight; ++i) {
+            finish_capture(i);
+        }
+        frame_writer.stop();
+        // Frames the writer had to leave out were read back for nothing.
+        captured_frames -= frame_writer.frames_skipped;
+        dropped_frames += frame_writer.frames_skipped;
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - capture_start).count();
+        std::cout << "Capture: " << captured_frames << " frames read back, " << dropped_frames << " dropped, "
+                  << frame_writer.frames_written << " written to " << options.capture_path << "\n";
+        std::cout << "Capture: readback " << (readback_bytes / (1024.0 * 1024.0)) / seconds << " MiB/s over " << seconds << "s, "
+                  << "encoder " << (frame_writer.bytes_encoded / (1024.0 * 1024.0)) / std::max(frame_writer.encode_seconds, 1e-9) << " MiB/s\n";
+        for (auto &slot : capture_slots) {
+            destroy_capture_slot(slot);
+        }
+    }
+
+    if (!options.compare_path.empty()) {
+        RgbImage reference;
+        const RgbImage &frame = frame_writer.last_frame;
+        if (!load_reference_image(options.compare_path, reference)) {
+            exit_code = 1;
+        } else if (frame.rgb.empty()) {
+            std::cerr << "Compare: no frame was captured to compare against " << options.compare_path << "\n";
+            exit_code = 1;
+        } else if (frame.width != reference.width || frame.height != reference.height) {
+            std::cerr << "Compare: frame is " << frame.width << "x" << frame.height << " but reference is "
+                      << reference.width << "x" << reference.height << "\n";
+            exit_code = 1;
+        } else {
+            uint64_t mismatched = 0;
+            int max_diff = 0;
+            for (std::size_t i = 0; i < frame.rgb.size(); i += 3) {
+                int diff = 0;
+                for (std::size_t c = 0; c != 3; ++c) {
+                    diff = std::max(diff, std::abs(int(frame.rgb[i + c]) - int(reference.rgb[i + c])));
+                }
+                max_diff = std::max(max_diff, diff);
+                if (static_cast<uint64_t>(diff) > options.tolerance) {
+                    ++mismatched;
+                }
+            }
+            const double mismatch_percent = 100.0 * mismatched / (frame.rgb.size() / 3);
+            const bool pass = mismatch_percent <= options.max_mismatch_percent;
+            std::cout << "Compare: " << (pass ? "PASS" : "FAIL") << " against " << options.compare_path << ", "
+                      << mismatched << " pixels (" << mismatch_percent << "%) differ by more than " << options.tolerance
+                      << ", max difference " << max_diff << "\n";
+            if (!pass) {
+                exit_code = 1;
+            }
+        }
+    }
+
+    if (!options.perf_baseline_path.empty() || !options.write_perf_baseline_path.empty()) {
+        if (!startup_ms || frame_count <= perf_warmup_frames) {
+            std::cerr << "Perf: need more than " << perf_warmup_frames << " frames to measure frame time\n";
+            exit_code = 1;
+        } else {
+            const double frame_ms = std::chrono::duration<double, std::milli>(perf_end - perf_begin).count() / (frame_count - perf_warmup_frames);
+            std::cout << "Perf: startup " << *startup_ms << "ms, frame " << frame_ms << "ms\n";
+
+            if (!options.write_perf_baseline_path.empty()) {
+                std::ofstream file(options.write_perf_baseline_path);
+                file << "startup_ms " << *startup_ms << "\n" << "frame_ms " << frame_ms << "\n";
+                if (!file) {
+                    std::cerr << "Perf: failed to write baseline " << options.write_perf_baseline_path << "\n";
+                    exit_code = 1;
+                }
+            }
+
+            if (!options.perf_baseline_path.empty()) {
+                std::ifstream file(options.perf_baseline_path);
+                std::optional<double> baseline_startup_ms, baseline_frame_ms;
+                std::string key;
+                double value;
+                while (file >> key >> value) {
+                    if (key == "startup_ms") {
+                        baseline_startup_ms = value;
+                    } else if (key == "frame_ms") {
+                        baseline_frame_ms = value;
+                    }
+                }
+                if (!baseline_startup_ms || !baseline_frame_ms) {
+                    std::cerr << "Perf: couldn't read baseline " << options.perf_baseline_path << "\n";
+                    exit_code = 1;
+                } else {
+                    const double limit = 1.0 + options.perf_threshold_percent / 100.0;
+                    auto check = [&](const char *name, double measured, double baseline) {
+                        const bool pass = measured <= baseline * limit;
+                        std::cout << "Perf: " << (pass ? "PASS" : "FAIL") << " " << name << " " << measured << "ms vs baseline "
+                                  << baseline << "ms (limit +" << options.perf_threshold_percent << "%)\n";
+                        if (!pass) {
+                            exit_code = 1;
+                        }
+                    };
+                    check("startup", *startup_ms, *baseline_startup_ms);
+                    check("frame", frame_ms, *baseline_frame_ms);
+                }
+            }
+        }
+    }
+
+    if (frame_count != 0) {
+        std::cout << "Commands: scene recorded " << commands_recorded << " times";
+        if (options.reuse_commands) {
+            std::cout << ", reused " << commands_reused << " times";
+        }
+        std::cout << ", " << frame_cpu_seconds * 1e6 / frame_count << "us CPU per frame from acquire to submit\n";
+    }
+    std::cout << "Swap chain: created in " << create_swap_chain_seconds * 1e3 << "ms";
+    if (swap_chain_recreations != 0) {
+        std::cout << ", recreated " << swap_chain_recreations << " times averaging "
+                  << recreate_seconds * 1e3 / swap_chain_recreations << "ms";
+    }
+    std::cout << " with " << (options.dynamic_rendering ? "dynamic rendering" : "render passes and framebuffers") << "\n";
+    if (stats_frames != 0) {
+        std::cout << "Pipeline stats: per frame";
+        for (uint32_t i = 0; i != n_stats; ++i) {
+            std::cout << (i ? ", " : " ") << stat_names[i] << " " << static_cast<double>(stats_total[i]) / stats_frames;
+        }
+        std::cout << " over " << stats_frames << " frames\n";
+    }
+    if (overdraw_frames != 0) {
+        std::cout << "Overdraw: " << overdraw_total / overdraw_frames << " fragments per pixel average, "
+                  << overdraw_max << " worst frame over " << overdraw_frames << " frames\n";
+    }
+    if (tracer.enabled && !tracer.write(options.trace_path)) {
+        exit_code = 1;
+    }
+    if (frame_count != 0) {
+        if (simulation) {
+            simulation->stop();
+            std::cout << "Simulation: " << n_objects << " objects, " << simulation->ticks << " ticks at " << simulation->ticks / simulation->run_seconds
+                      << " Hz (" << options.tick_rate << " Hz fixed), " << simulation->tick_seconds_total * 1e6 / std::max<uint64_t>(simulation->ticks, 1)
+                      << "us per tick, started " << simulation->jitter_ms_total / std::max<uint64_t>(simulation->ticks, 1) << "ms late on average and "
+                      << simulation->jitter_ms_max << "ms at worst, " << simulation->ticks_dropped << " ticks dropped\n";
+            std::cout << "  Rendering at " << frame_count / simulation->run_seconds << " fps, interpolating in "
+                      << scene_seconds * 1e6 / frame_count << "us per frame\n";
+        } else {
+            std::cout << "Scene: " << n_objects << " objects, " << scene_seconds * 1e6 / frame_count << "us per update ("
+                      << n_objects * frame_count / scene_seconds / 1e6 << " M objects/s) on "
+                      << (scene_pool ? scene_pool->size() + 1 : 1) << " threads\n";
+        }
+        if (mesh_lods.size() > 1 || options.lod) {
+            std::cout << "LOD: " << mesh_lods.size() << " levels of";
+            for (const MeshLod &lod : mesh_lods) {
+                std::cout << " " << lod.index_count / 3;
+            }
+            std::cout << " triangles, built in " << lod_build_ms << "ms\n";
+            for (int on = 1; on >= 0; --on) {
+                if (lod_frames[on] != 0) {
+                    std::cout << "  LOD " << (on ? "on: " : "off: ") << lod_triangles[on] / lod_frames[on] << " triangles and "
+                              << lod_frame_seconds[on] * 1e3 / lod_frames[on] << "ms per frame over " << lod_frames[on] << " frames\n";
+                }
+            }
+        }
+        if (options.cull) {
+            bvh.stop();
+            std::cout << "Culling: " << (n_objects ? 100.0 * objects_culled / (static_cast<double>(n_objects) * frame_count) : 0.0) << "% of objects culled, "
+                      << cull_seconds * 1e6 / frame_count << "us cull and " << refit_seconds * 1e6 / frame_count << "us refit per frame; BVH of "
+                      << bvh.nodes() << " nodes built in " << bvh_build_ms << "ms, rebuilt " << bvh.rebuilds << " times in the background averaging "
+                      << (bvh.rebuilds ? bvh.rebuild_seconds * 1e3 / bvh.rebuilds : 0.0) << "ms\n";
+        }
+        std::cout << "Draws: " << (options.cull ? static_cast<double>(n_objects) - static_cast<double>(objects_culled) / frame_count : n_objects) << " per frame using " << (options.bindless ? "bindless table" : "per-draw descriptor sets")
+                  << ", recording " << record_seconds * 1e6 / frame_count << "us per frame ("
+                  << (draws_recorded ? record_seconds * 1e9 / draws_recorded : 0.0) << "ns per draw)";
+        if (gpu_frames != 0) {
+            std::cout << ", GPU " << gpu_ms_total / gpu_frames << "ms per frame";
+        }
+        std::cout << "\n";
+    }
+    if (n_particles != 0) {
+        std::cout << "Particles: " << n_particles << " simulated on the ";
+        if (async_compute) {
+            std::cout << "async compute queue (family " << queue_compute_family << ")";
+        } else {
+            std::cout << "graphics queue";
+        }
+        if (particle_steps_timed != 0) {
+            std::cout << ", " << particle_gpu_ms_total * 1e3 / particle_steps_timed << "us GPU per step";
+            if (particle_overlap_gpu_ms_total > 0.0) {
+                std::cout << ", " << 100.0 * particle_overlap_ms_total / particle_overlap_gpu_ms_total
+                          << "% overlapped with the previous frame's rendering";
+            } else {
+                std::cout << ", overlap with rendering unknown without calibrated timestamps";
+            }
+        }
+        std::cout << "\n";
+    }
+    if (idle_seconds > 0.0) {
+        std::cout << "Idle: " << idle_seconds << "s idle at " << 100.0 * idle_cpu_seconds / idle_seconds << "% CPU";
+        if (wakes != 0) {
+            std::cout << ", " << wakes << " wakes, wake to present " << wake_latency_ms_total / wakes << "ms average, "
+                      << wake_latency_ms_max << "ms max";
+        }
+        std::cout << "\n";
+    }
+    if (latency_frames != 0) {
+        std::cout << "Latency: input sample to GPU done " << latency_ms_total / latency_frames << "ms average, "
+                  << latency_ms_max << "ms max over " << latency_frames << " frames"
+                  << (options.low_latency ? " with" : " without") << " the latency limiter\n";
+    }
+    {
+        const Logger::ThreadStats &log_stats = Logger::thread_stats();
+        std::cout << "Log: " << (options.log_sync ? "synchronous" : "async") << " at " << log_level_name(logger.level()) << " level, "
+                  << log_stats.lines << " lines from the main thread at " << (log_stats.lines ? log_stats.seconds * 1e6 / log_stats.lines : 0.0)
+                  << "us each, " << log_stats.max_seconds * 1e6 << "us at worst, " << logger.dropped() << " lines dropped\n";
+    }
+    if (storm_frames != 0) {
+        std::cout << "Resize storm: " << storm_frames << " frames, " << storm_recreations << " swap chain recreations, "
+                  << storm_seconds * 1e3 / storm_frames << "ms per frame, " << storm_max_seconds * 1e3 << "ms at worst, "
+                  << storm_log_lines << " lines logged taking " << storm_log_seconds * 1e6 / storm_frames << "us per frame\n";
+    }
+    if (frame_count != 0) {
+        std::cout << "Sync: " << (options.timeline_semaphores ? "timeline semaphore" : "fences") << ", "
+                  << sync_seconds * 1e6 / frame_count << "us CPU per frame\n";
+    }
+    std::cout << "Textures: " << streamer.resident_bytes() / (1024.0 * 1024.0) << " MiB resident of "
+              << options.texture_budget_mb << " MiB budget\n";
+    if (!options.bundle_path.empty()) {
+        bundle.report();
+    }
+    streamer.destroy();
+    for (auto &deletion : deferred_deletions) {
+        deletion.second();
+    }
+    vkDestroyDescriptorPool(device, descriptor_pool, apiAllocCallbacks);
+    if (n_particles != 0) {
+        for (std::size_t i = 0; i != max_frames_in_flight; ++i) {
+            vkDestroyBuffer(device, particle_buffers[i], apiAllocCallbacks);
+            vkFreeMemory(device, particle_allocs[i], apiAllocCallbacks);
+            vkDestroySemaphore(device, particles_ready_sem[i], apiAllocCallbacks);
+        }
+        if (compute_timestamp_pool != VK_NULL_HANDLE) {
+            vkDestroyQueryPool(device, compute_timestamp_pool, apiAllocCallbacks);
+        }
+        vkDestroyCommandPool(device, compute_command_pool, apiAllocCallbacks);
+        vkDestroyDescriptorPool(device, particle_descriptor_pool, apiAllocCallbacks);
+        vkDestroyPipeline(device, compute_pipeline, apiAllocCallbacks);
+        vkDestroyPipelineLayout(device, compute_layout, apiAllocCallbacks);
+        vkDestroyDescriptorSetLayout(device, particle_set_layout, apiAllocCallbacks);
+        vkDestroyPipeline(device, particle_pipeline, apiAllocCallbacks);
+        vkDestroyPipelineLayout(device, particle_layout, apiAllocCallbacks);
+        vkDestroyShaderModule(device, particle_compute_module, apiAllocCallbacks);
+        vkDestroyShaderModule(device, particle_vert_module, apiAllocCallbacks);
+        vkDestroyShaderModule(device, particle_frag_module, apiAllocCallbacks);
+    }
+    for (std::size_t i = 0; i != max_frames_in_flight; ++i) {
+        vkUnmapMemory(device, object_buffer_allocs[i]);
+        vkDestroyBuffer(device, object_buffers[i], apiAllocCallbacks);
+        vkFreeMemory(device, object_buffer_allocs[i], apiAllocCallbacks);
+    }
+    vkDestroyImageView(device, placeholder_view, apiAllocCallbacks);
+    vkDestroyImage(device, placeholder_image, apiAllocCallbacks);
+    vkFreeMemory(device, placeholder_memory, apiAllocCallbacks);
+    vkDestroySampler(device, sampler, apiAllocCallbacks);
 
     for (auto &fence : in_flight_fence) {
-        vkDestroyFence(device, fence, apiAllocCallbacks);
+        if (fence != VK_NULL_HANDLE) {
+            vkDestroyFence(device, fence, apiAllocCallbacks);
+        }
+    }
+    if (frame_timeline != VK_NULL_HANDLE) {
+        vkDestroySemaphore(device, frame_timeline, apiAllocCallbacks);
     }
     for (auto &sem : render_finished_sem) {
         vkDestroySemaphore(device, sem, apiAllocCallbacks);
@@ -1123,6 +8001,12 @@ int main(int argc, char** argv) {
     for (auto &sem : image_available_sem) {
         vkDestroySemaphore(device, sem, apiAllocCallbacks);
     }
+    if (timestamp_pool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, timestamp_pool, apiAllocCallbacks);
+    }
+    if (stats_pool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, stats_pool, apiAllocCallbacks);
+    }
     vkDestroyCommandPool(device, command_pool, apiAllocCallbacks);
 
     vkDestroyBuffer(device, vb, apiAllocCallbacks);
@@ -1132,18 +8016,31 @@ int main(int argc, char** argv) {
 
     vkDestroyPipeline(device, graphics_pipeline, apiAllocCallbacks);
     vkDestroyRenderPass(device, render_pass, apiAllocCallbacks);
+    if (overdraw_pipeline != VK_NULL_HANDLE) {
+        vkDestroyPipeline(device, overdraw_pipeline, apiAllocCallbacks);
+        vkDestroyRenderPass(device, overdraw_render_pass, apiAllocCallbacks);
+        vkDestroyShaderModule(device, overdraw_frag_module, apiAllocCallbacks);
+    }
+    if (scaled_render_pass != VK_NULL_HANDLE) {
+        vkDestroyRenderPass(device, scaled_render_pass, apiAllocCallbacks);
+    }
     vkDestroyPipelineLayout(device, pipeline_layout, apiAllocCallbacks);
+    vkDestroyDescriptorSetLayout(device, set_layout, apiAllocCallbacks);
 
     vkDestroyShaderModule(device, vert_module, apiAllocCallbacks);
     vkDestroyShaderModule(device, frag_module, apiAllocCallbacks);
 
     cleanup_swap_chain();
     vkDestroyDevice(device, apiAllocCallbacks);
-    vkDestroySurfaceKHR(instance, surface, apiAllocCallbacks);
+    // SDL created the surface without allocation callbacks.
+    vkDestroySurfaceKHR(instance, surface, nullptr);
     vkDestroyInstance(instance, apiAllocCallbacks);
+    if (host_allocator) {
+        host_allocator->report();
+    }
 
     SDL_DestroyWindow(window);
     SDL_Quit();
 
-    return 0;
+    return exit_code;
 }
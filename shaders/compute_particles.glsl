@@ -0,0 +1,63 @@
+#version 450
+
+layout(local_size_x = 256) in;
+
+struct Particle {
+  vec2 pos;
+  vec2 vel;
+};
+
+// Last frame's particles in, this frame's out.
+layout(set = 0, binding = 0) readonly buffer Previous {
+  Particle previous[];
+};
+layout(set = 0, binding = 1) writeonly buffer Current {
+  Particle current[];
+};
+
+layout(push_constant) uniform Step {
+  float dt;
+  float time;
+  uint count;
+} params;
+
+uint hash(uint x) {
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+float random(uint seed) {
+  return float(hash(seed) & 0xffffu) / 65535.0;
+}
+
+void main() {
+  uint i = gl_GlobalInvocationID.x;
+  if (i >= params.count) {
+    return;
+  }
+  Particle p = previous[i];
+
+  // Falling, with y down in NDC, and bouncing off the sides and floor.
+  p.vel.y += 1.5 * params.dt;
+  p.pos += p.vel * params.dt;
+  if (abs(p.pos.x) > 1.0) {
+    p.pos.x = sign(p.pos.x);
+    p.vel.x = -0.8 * p.vel.x;
+  }
+  if (p.pos.y > 1.0) {
+    p.pos.y = 1.0;
+    p.vel.y = -0.6 * p.vel.y;
+    // Once it's settled, back out of the fountain.
+    if (abs(p.vel.y) < 0.1) {
+      uint seed = i * 3u + uint(params.time * 1000.0) * 7919u;
+      p.pos = vec2(0.0, 0.9);
+      p.vel = vec2(random(seed) - 0.5, -1.5 - random(seed + 1u));
+    }
+  }
+
+  current[i] = p;
+}
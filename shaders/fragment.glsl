@@ -1,9 +1,12 @@
 #version 450
 
 layout(location = 0) in vec3 in_colour;
+layout(location = 1) in vec2 in_uv;
+
+layout(set = 0, binding = 0) uniform sampler2D tex;
 
 layout(location = 0) out vec4 out_colour;
 
 void main() {
-  out_colour = vec4(in_colour, 1.0);
+  out_colour = vec4(in_colour, 1.0) * texture(tex, in_uv);
 }
\ No newline at end of file
@@ -0,0 +1,20 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(location = 0) in vec3 in_colour;
+layout(location = 1) in vec2 in_uv;
+
+layout(push_constant) uniform Draw {
+  uint texture_index;
+  uint buffer_index;
+  uint object_index;
+} draw;
+
+// Every texture in the table.
+layout(set = 0, binding = 0) uniform sampler2D textures[];
+
+layout(location = 0) out vec4 out_colour;
+
+void main() {
+  out_colour = vec4(in_colour, 1.0) * texture(textures[draw.texture_index], in_uv);
+}
\ No newline at end of file
@@ -0,0 +1,9 @@
+#version 450
+
+// Every fragment adds one, so with additive blending the target ends up
+// holding how many times each pixel was shaded.
+layout(location = 0) out vec4 out_overdraw;
+
+void main() {
+  out_overdraw = vec4(1.0, 0.0, 0.0, 0.0);
+}
\ No newline at end of file
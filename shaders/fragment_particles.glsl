@@ -0,0 +1,15 @@
+#version 450
+
+layout(location = 0) in vec3 in_colour;
+layout(location = 1) in vec2 in_offset;
+
+layout(location = 0) out vec4 out_colour;
+
+void main() {
+  // Round, fading out towards the edge, and added on top of the scene.
+  float r = dot(in_offset, in_offset);
+  if (r > 1.0) {
+    discard;
+  }
+  out_colour = vec4(in_colour * (1.0 - r), 1.0);
+}
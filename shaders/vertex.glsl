@@ -2,10 +2,19 @@
 
 layout(location = 0) in vec2 in_pos;
 layout(location = 1) in vec3 in_colour;
+layout(location = 2) in vec2 in_uv;
 
 layout(location = 0) out vec3 frag_colour;
+layout(location = 1) out vec2 frag_uv;
+
+// The top two rows of the world matrix, xyz used.
+layout(set = 0, binding = 1) uniform Object {
+  vec4 rows[2];
+} object;
 
 void main() {
-  gl_Position = vec4(in_pos, 0.0, 1.0);
+  vec3 p = vec3(in_pos, 1.0);
+  gl_Position = vec4(dot(object.rows[0].xyz, p), dot(object.rows[1].xyz, p), 0.0, 1.0);
   frag_colour = in_colour;
+  frag_uv = in_uv;
 }
\ No newline at end of file
@@ -0,0 +1,29 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(location = 0) in vec2 in_pos;
+layout(location = 1) in vec3 in_colour;
+layout(location = 2) in vec2 in_uv;
+
+layout(location = 0) out vec3 frag_colour;
+layout(location = 1) out vec2 frag_uv;
+
+layout(push_constant) uniform Draw {
+  uint texture_index;
+  uint buffer_index;
+  uint object_index;
+} draw;
+
+// Every buffer in the table, each an array of world matrices as two rows.
+layout(set = 0, binding = 1) readonly buffer Objects {
+  vec4 rows[];
+} objects[];
+
+void main() {
+  vec3 p = vec3(in_pos, 1.0);
+  vec4 row0 = objects[draw.buffer_index].rows[draw.object_index * 2];
+  vec4 row1 = objects[draw.buffer_index].rows[draw.object_index * 2 + 1];
+  gl_Position = vec4(dot(row0.xyz, p), dot(row1.xyz, p), 0.0, 1.0);
+  frag_colour = in_colour;
+  frag_uv = in_uv;
+}
\ No newline at end of file
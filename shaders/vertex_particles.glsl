@@ -0,0 +1,24 @@
+#version 450
+
+// One particle per instance, straight out of the simulation's buffer.
+layout(location = 0) in vec2 in_pos;
+layout(location = 1) in vec2 in_vel;
+
+layout(location = 0) out vec3 frag_colour;
+layout(location = 1) out vec2 frag_offset;
+
+// Half the sprite's size in NDC.
+layout(push_constant) uniform Sprite {
+  vec2 size;
+} sprite;
+
+void main() {
+  // Two triangles from the vertex index, so there's no vertex buffer.
+  const vec2 corners[6] = vec2[](vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0),
+                                 vec2(1.0, 1.0), vec2(-1.0, 1.0), vec2(-1.0, -1.0));
+  vec2 corner = corners[gl_VertexIndex];
+  gl_Position = vec4(in_pos + corner * sprite.size, 0.0, 1.0);
+  // Blue when slow, orange when fast.
+  frag_colour = mix(vec3(0.2, 0.4, 1.0), vec3(1.0, 0.6, 0.2), clamp(length(in_vel) * 0.5, 0.0, 1.0));
+  frag_offset = corner;
+}